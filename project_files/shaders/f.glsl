@@ -1,20 +1,52 @@
 #version 330
 
-const int MAX_POINTS = 128;
-
-// from glState
-uniform ivec2 iResolution;
-uniform vec3 cameraPosition;
-uniform mat3 camTBNMat;
-uniform vec2 planetRotationAngleRadians;
-uniform float noiseOffset;
-uniform int fbmIterations;
-uniform bool performanceMode;
-uniform int numUserAddedPoints;
-uniform bool hardShadowsEnable;
-uniform vec3 pArray[MAX_POINTS];
-uniform float rArray[MAX_POINTS];
-uniform float hArray[MAX_POINTS];
+const int MOUND_CELLS_PER_EDGE = 16;  // MoundIndex::cellsPerEdge
+
+// from glState. Per frame state in one std140 block (GLState::FrameUniforms), uploaded only when it changed
+layout(std140) uniform FrameUniforms {
+    mat3 camTBNMat;
+    mat3 planetRotation;        // world to planet space, PlanetSphere::rotation
+    vec3 cameraPosition;
+    float noiseOffset;
+    ivec2 iResolution;
+    int frameFbmIterations;     // read through the names below by the generic program only
+    bool framePerformanceMode;
+    bool frameHardShadows;
+    bool bakedTerrain;
+    float terrainMaxDisplace;   // upper bound of displace(), see TerrainEditor::getDisplacementBounds
+    float terrainLipschitz;     // bound on the slope of terrainSDF() (empirical noise part), see TerrainEditor::getLipschitzBound
+    int marchMode;              // GLState::MarchMode
+    int prepassFactor;          // pixels per prepass block edge, 0 when there is no prepass
+    bool splatEdits;            // read the mounds from editHeights instead of looping over them
+};
+
+// Compile time in the variants GLState::buildShader makes, so branches fold and the fbm loops
+// unroll. The generic program without defines reads them from the frame block
+#ifdef FBM_ITERATIONS
+const int fbmIterations = FBM_ITERATIONS;
+#else
+#define fbmIterations frameFbmIterations
+#endif
+#ifdef PERFORMANCE_MODE
+const bool performanceMode = PERFORMANCE_MODE != 0;
+#else
+#define performanceMode framePerformanceMode
+#endif
+#ifdef HARD_SHADOWS
+const bool hardShadowsEnable = HARD_SHADOWS != 0;
+#else
+#define hardShadowsEnable frameHardShadows
+#endif
+
+// Set only around readback and prepass draws
+uniform bool terrainReadback;
+uniform bool stepReadback;
+uniform bool depthPrepass;          // cone march pass of GLState::paintGL, writes (start distance, steps)
+uniform samplerCube terrainCubemap;
+uniform sampler2D prepassDepth;
+uniform usamplerBuffer moundIndex;  // TerrainEditor::getMoundIndex(), cell offsets then mound lists
+uniform isamplerBuffer moundData;   // PackedMound per mound, see fetchMound()
+uniform samplerCube editHeights;    // TerrainEditor::getEditField(), summed mound heights per direction
 
 smooth in vec3 fragNorm;    // Interpolated model-space normal
 out vec3 outCol;    // Final pixel color
@@ -54,6 +86,12 @@ Material mat_stone  = Material(vec3(136.0f, 140.0f, 141.0f) / 255.0f,   0.7,   0
 Material mat_sun    = Material(vec3(255.0f, 211.0f, 92.0f)  / 255.0f,   1.0,   0.0,    0.0,    0.0);
 
 
+// Sphere tracing variants (GLState::MarchMode)
+const int MARCH_PLAIN = 0;
+const int MARCH_LIPSCHITZ = 1;
+const int MARCH_RELAXED = 2;
+const float MARCH_RELAXATION = 1.6;
+
 // Intersection types
 const int NON_INTERSECT = 0;
 const int SUN_INTERSECT = 1;
@@ -75,6 +113,7 @@ const int N_POINTS = 100; // Change this number to increase/reduce number of poi
 const int MAX_STEPS = 64; // 256
 const float MAX_DIST = 50.0; // 500
 const float EPSILON = 0.001; // 0.00001
+int marchSteps = 0; // terrain SDF evaluations so far for this pixel, written out for GLState::measureMarchSteps
 
 float gold_noise(in vec2 coordinate, in float seed){
     return fract(tan(distance(coordinate*(seed+PHI), vec2(PHI, PI)))*SQ2);
@@ -96,6 +135,19 @@ float sphereSDF(vec3 p, vec3 center, float radius) {
     return length(p - center) - radius;
 }
 
+// entry and exit distance along a normalized ray, x > y on a miss
+vec2 sphereIntersect(vec3 ro, vec3 rd, vec3 center, float radius) {
+    vec3 oc = ro - center;
+    float b = dot(oc, rd);
+    float c = dot(oc, oc) - radius * radius;
+    float h = b * b - c;
+    if (h < 0.0) {
+        return vec2(MAX_DIST, -MAX_DIST);
+    }
+    h = sqrt(h);
+    return vec2(-b - h, -b + h);
+}
+
 vec3 random_sphere_point(int i) {  // used for shadow calculation (random points used as light sphere)
     // generating uniform points on the sphere: http://corysimon.github.io/articles/uniformdistn-on-sphere/
     float fi = float(i);
@@ -115,7 +167,8 @@ vec3 reflection(vec3 vec_in, vec3 normal) {
 }
 
 vec3 sky_color(vec3 ro, vec3 rd) {
-    return vec3(0.0) - (rd.y) * 0.2 * vec3(0.05) + 0.05 * 1.0;
+    float up = dot(rd, planetRotation[1]); // world space rd.y
+    return vec3(0.0) - (up) * 0.2 * vec3(0.05) + 0.05 * 1.0;
     // return vec3(0.05);
 }
 
@@ -136,7 +189,8 @@ vec4 inverseSqrtT(vec4 p) {
 }
 
 // Help from: https://www.cs.umd.edu/class/spring2018/cmsc425/Lects/lect13-2d-perlin.pdf
-float getNoiseAt(vec3 samplePoint) {
+// Simplex cell around samplePoint: offsets c from its four corners and the corner gradients g
+void simplexCorners(vec3 samplePoint, out vec3 c[4], out vec3 g[4]) {
     vec3 sp = samplePoint + noiseOffset;
     const vec2 constant = vec2(1.0 / 6.0,  1.0 / 3.0);
 
@@ -148,9 +202,10 @@ float getNoiseAt(vec3 samplePoint) {
     vec3 b = 1.0 - a;
     vec3 i1 = min(a.xyz, b.zxy);
     vec3 i2 = max(a.xyz, b.zxy);
-    vec3 c2 = c1 - i1 + constant.xxx;
-    vec3 c3 = c1 - i2 + constant.yyy;
-    vec3 c4 = c1 - 0.5;
+    c[0] = c1;
+    c[1] = c1 - i1 + constant.xxx;
+    c[2] = c1 - i2 + constant.yyy;
+    c[3] = c1 - 0.5;
 
     
     // permutations
@@ -165,37 +220,61 @@ float getNoiseAt(vec3 samplePoint) {
     vec4 y = (d2 * 2.0 + 0.5) / 7.0 - 1.0;
 
     vec4 f = vec4(x.xy, y.xy);
-    vec4 g = vec4(x.zw, y.zw);
+    vec4 gr = vec4(x.zw, y.zw);
     vec4 h = 1.0 - abs(x) - abs(y);
 
     vec4 i = floor(f) * 2.0 + 1.0;
-    vec4 j = floor(g) * 2.0 + 1.0;
+    vec4 j = floor(gr) * 2.0 + 1.0;
     vec4 k = -step(h, vec4(0.0));
 
     vec4 m = f.xzyw + i.xzyw * k.xxyy;
-    vec4 n = g.xzyw + j.xzyw * k.zzww;
+    vec4 n = gr.xzyw + j.xzyw * k.zzww;
 
-    vec3 g1 = vec3(m.xy, h.x);
-    vec3 g2 = vec3(m.zw, h.y);
-    vec3 g3 = vec3(n.xy, h.z);
-    vec3 g4 = vec3(n.zw, h.w);
+    g[0] = vec3(m.xy, h.x);
+    g[1] = vec3(m.zw, h.y);
+    g[2] = vec3(n.xy, h.z);
+    g[3] = vec3(n.zw, h.w);
 
     // interpolation
-    vec4 norm = inverseSqrtT(vec4(dot(g1, g1), dot(g2, g2), dot(g3, g3), dot(g4, g4)));
-    g1 *= norm.x;
-    g2 *= norm.y;
-    g3 *= norm.z;
-    g4 *= norm.w;
-    
-    vec4 maxv = max(0.6 - vec4(dot(c1, c1), dot(c2, c2), dot(c3, c3), dot(c4, c4)), 0.0);
+    vec4 norm = inverseSqrtT(vec4(dot(g[0], g[0]), dot(g[1], g[1]), dot(g[2], g[2]), dot(g[3], g[3])));
+    g[0] *= norm.x;
+    g[1] *= norm.y;
+    g[2] *= norm.z;
+    g[3] *= norm.w;
+}
+
+float getNoiseAt(vec3 samplePoint) {
+    vec3 c[4], g[4];
+    simplexCorners(samplePoint, c, g);
+
+    vec4 maxv = max(0.6 - vec4(dot(c[0], c[0]), dot(c[1], c[1]), dot(c[2], c[2]), dot(c[3], c[3])), 0.0);
     maxv = maxv * maxv;
     maxv = maxv * maxv;
     
-    vec4 p = vec4(dot(c1, g1), dot(c2, g2), dot(c3, g3), dot(c4, g4));
+    vec4 p = vec4(dot(c[0], g[0]), dot(c[1], g[1]), dot(c[2], g[2]), dot(c[3], g[3]));
 
     return 50.0 * dot(maxv, p);
 }
 
+// getNoiseAt with its analytic gradient: value in x, gradient in yzw
+vec4 getNoiseAtD(vec3 samplePoint) {
+    vec3 c[4], g[4];
+    simplexCorners(samplePoint, c, g);
+
+    vec4 maxv = max(0.6 - vec4(dot(c[0], c[0]), dot(c[1], c[1]), dot(c[2], c[2]), dot(c[3], c[3])), 0.0);
+    vec4 maxv2 = maxv * maxv;
+    vec4 maxv4 = maxv2 * maxv2;
+
+    vec4 p = vec4(dot(c[0], g[0]), dot(c[1], g[1]), dot(c[2], g[2]), dot(c[3], g[3]));
+
+    // d(maxv^4 * dot(c, g)) = maxv^4 * g - 8 * maxv^3 * dot(c, g) * c, as c moves 1:1 with the sample point
+    vec4 t = -8.0 * maxv2 * maxv * p;
+    vec3 grad = maxv4.x * g[0] + maxv4.y * g[1] + maxv4.z * g[2] + maxv4.w * g[3]
+              + t.x * c[0] + t.y * c[1] + t.z * c[2] + t.w * c[3];
+
+    return 50.0 * vec4(dot(maxv4, p), grad);
+}
+
 float fbm(vec3 samplePoint){
     float sum = 0;
     float amplitude = 1;
@@ -210,24 +289,69 @@ float fbm(vec3 samplePoint){
     return sum;
 }
 
-vec3 rotateYX(vec3 init, vec2 angle){
-    float angleY = angle.x;
-    float angleX = angle.y;
-    vec3 npt = init;
-    npt.x = (init.x * cos(angleY)) + (init.z * sin(angleY));
-    npt.z = -(init.x * sin(angleY)) + (init.z * cos(angleY));
-    vec3 newPos = npt;
-    newPos.y = (npt.y * cos(angleX)) - (npt.z * sin(angleX));
-    newPos.z = (npt.y * sin(angleX)) + (npt.z * cos(angleX));
-    return newPos;
+// fbm with its gradient: value in x, gradient in yzw (each octave's gradient scales by amplitude * frequency)
+vec4 fbmD(vec3 samplePoint){
+    vec4 sum = vec4(0.0);
+    float amplitude = 1;
+    float frequency = 1;
+    for (int i = 0; i < fbmIterations; i++) {
+        vec4 n = getNoiseAtD(samplePoint * frequency);
+        sum += vec4(n.x * amplitude, n.yzw * (amplitude * frequency));
+        frequency *= 2;
+        amplitude *= 0.5;
+    }
+
+    return sum;
+}
+
+// Cube-face grid cell of the direction of p, MoundIndex::cellOf
+int moundCell(vec3 p) {
+    vec3 a = abs(p);
+    int axis = ((a.x >= a.y) && (a.x >= a.z)) ? 0 : ((a.y >= a.z) ? 1 : 2);
+    float major = max(a[axis], 1e-30);
+    vec2 st = vec2(p[(axis + 1) % 3], p[(axis + 2) % 3]) / major;
+    int face = axis * 2 + ((p[axis] < 0.0) ? 1 : 0);
+    ivec2 xy = clamp(ivec2((st * 0.5 + 0.5) * float(MOUND_CELLS_PER_EDGE)), 0, MOUND_CELLS_PER_EDGE - 1);
+    return (face * MOUND_CELLS_PER_EDGE + xy.y) * MOUND_CELLS_PER_EDGE + xy.x;
 }
 
+// Cubemap value along p with its gradient: value in x, gradient in yzw. The fields have no analytic
+// gradient, but central differences are only texture taps
+vec4 cubemapD(samplerCube field, vec3 p) {
+    const vec2 e = vec2(0.001, 0.0);
+    vec4 ret;
+    ret.x = textureLod(field, p, 0.0).r;
+    ret.y = textureLod(field, p + e.xyy, 0.0).r - textureLod(field, p - e.xyy, 0.0).r;
+    ret.z = textureLod(field, p + e.yxy, 0.0).r - textureLod(field, p - e.yxy, 0.0).r;
+    ret.w = textureLod(field, p + e.yyx, 0.0).r - textureLod(field, p - e.yyx, 0.0).r;
+    ret.yzw /= 2.0 * e.x;
+    return ret;
+}
+
+// Mound i of moundData: octahedral center in two snorm16, radius and height as half floats (unpackMound).
+// GLSL 3.30 has no unpackHalf2x16, but half bits shifted into a float are the value scaled by 2^-112
+void fetchMound(int i, out vec3 center, out float radius, out float height) {
+    ivec4 m = texelFetch(moundData, i);
+    vec2 o = clamp(vec2(m.xy) / 32767.0, -1.0, 1.0);
+    center = vec3(o, 1.0 - abs(o.x) - abs(o.y));
+    if (center.z < 0.0) {
+        center.xy = (1.0 - abs(o.yx)) * vec2(o.x >= 0.0 ? 1.0 : -1.0, o.y >= 0.0 ? 1.0 : -1.0);
+    }
+    center = normalize(center);
+    vec2 values = uintBitsToFloat((uvec2(m.zw) & 0x7FFFu) << 13) * 5.192296858534828e33;
+    values *= mix(vec2(1.0), vec2(-1.0), notEqual(uvec2(m.zw) & 0x8000u, uvec2(0u)));
+    radius = values.x;
+    height = values.y;
+}
+
+// p is in planet space: rays are rotated once in main(), not per sample
 float displace(vec3 p){
-    // apply rotation
-    vec3 newPos = rotateYX(p, planetRotationAngleRadians);
-    if (length(newPos) > EPSILON) {
-		p = newPos;
-	}
+    // baked displacement (fbm + user terrain), the cubemap GLState::updateBakedTerrain picks from planetCache (uploaded by cacheBakedTerrain)
+    if (bakedTerrain) {
+        // Sampled by direction, so this is displace(normalize(p)) and differs from the procedural surface
+        // by up to the terrain slope times |p| - 1 (see Heightfield, measured by GLState::verifyTerrain)
+        return textureLod(terrainCubemap, p, 0.0).r;
+    }
 
     // displace
     float ret;
@@ -235,15 +359,24 @@ float displace(vec3 p){
     // ret = abs(fbm(p)); // rivers on low points
     // ret = 1.0 - abs(fbm(p)); // mountains on high points
 
-    // Generate user terrain
-    for (int i = 0; i < numUserAddedPoints; i++) {
-        float prox = distance(p, pArray[i]);
-        if (prox <= rArray[i]) {
-            // ae^(- ((x - b)^2) / (2c^2))
-            float x = rArray[i] - prox;
-            float c = rArray[i] / 4.0;
-            float h = hArray[i] * exp(-(pow(prox, 2.0)) / (2.0 * pow(c, 2.0)));
-            ret += h / 0.05;
+    // Generate user terrain, splatted per edit or from only the mounds that can reach p's cell
+    if (splatEdits) {
+        ret += textureLod(editHeights, p, 0.0).r / 0.05;
+    }
+    else {
+        int cell = moundCell(p);
+        int end = int(texelFetch(moundIndex, cell + 1).r);
+        for (int j = int(texelFetch(moundIndex, cell).r); j < end; j++) {
+            vec3 center;
+            float radius, height;
+            fetchMound(int(texelFetch(moundIndex, j).r), center, radius, height);
+            float prox = distance(p, center);
+            if (prox <= radius) {
+                // ae^(- ((x - b)^2) / (2c^2))
+                float c = radius / 4.0;
+                float h = height * exp(-(pow(prox, 2.0)) / (2.0 * pow(c, 2.0)));
+                ret += h / 0.05;
+            }
         }
     }
     
@@ -252,49 +385,135 @@ float displace(vec3 p){
     return ret;
 }
 
-vec2 getRayMarchHit(vec3 p) {
-    // sphere
-    float sphereDist = sphereSDF(p, vec3(0.0, 0.0, 0.0), planetBaseSize + displace(p));
-    float sphereID =PLANET_INTERSECT;
-    vec2 sphere = vec2(sphereDist, sphereID);
-    // water sphere
-    float waterSphereDist = sphereSDF(p, vec3(0.0, 0.0, 0.0), planetBaseSize);
-    float waterSphereID = WATER_INTERSECT;
-    vec2 waterSphere = vec2(waterSphereDist, waterSphereID);
-    // sun sphere
-    float sunSphereDist = sphereSDF(p, light / 10.0, 0.35); 
-    float sunSphereID = SUN_INTERSECT;
-    vec2 sunSphere = vec2(sunSphereDist, sunSphereID);
-
-    vec2 res = (sphere.x < waterSphere.x) ? sphere : waterSphere;
-    res = (res.x < sunSphere.x) ? res : sunSphere;
-    return res;
+// displace() with its gradient: value in x, gradient in yzw
+vec4 displaceD(vec3 p){
+    vec4 ret;
+    if (bakedTerrain) {
+        ret = cubemapD(terrainCubemap, p);
+    }
+    else {
+        ret = fbmD(p);
+
+        if (splatEdits) {
+            ret += cubemapD(editHeights, p) / 0.05;
+        }
+        else {
+            int cell = moundCell(p);
+            int end = int(texelFetch(moundIndex, cell + 1).r);
+            for (int j = int(texelFetch(moundIndex, cell).r); j < end; j++) {
+                vec3 center;
+                float radius, height;
+                fetchMound(int(texelFetch(moundIndex, j).r), center, radius, height);
+                float prox = distance(p, center);
+                if (prox <= radius) {
+                    float c = radius / 4.0;
+                    float h = height * exp(-(pow(prox, 2.0)) / (2.0 * pow(c, 2.0)));
+                    // gradient of the Gaussian is -h * (p - center) / c^2
+                    ret += vec4(h, -h * (p - center) / pow(c, 2.0)) / 0.05;
+                }
+            }
+        }
+
+        ret *= 0.05; // normalize
+        ret.x -= 0.0075;
+    }
+
+    return ret;
+}
+
+// Normal of the displaced sphere length(p) - (planetBaseSize + displace(p)), from a single displaceD()
+vec3 terrainNormal(vec3 pos) {
+    return normalize(normalize(pos) - displaceD(pos).yzw);
+}
+
+float terrainSDF(vec3 p) {
+    return sphereSDF(p, vec3(0.0, 0.0, 0.0), planetBaseSize + displace(p));
 }
 
-vec2 rayMarch(vec3 ro, vec3 rd) {
-    vec2 hit, item;
-    for (int i = 0; i < MAX_STEPS; i++){
-        vec3 pos = ro + item.x * rd;
-        hit = getRayMarchHit(pos); // get sdf
-        item.x += hit.x; // increment by distance
-        item.y = hit.y;
+// Closest hit along the ray as (distance, intersection type). The water sphere and the sun are
+// intersected analytically, only the terrain is sphere traced, and only inside its bounding shell
+// from start (the depth prepass distance, if any) up to the closest analytic hit
+vec2 rayMarch(vec3 ro, vec3 rd, float start) {
+    vec2 item = vec2(2.0 * MAX_DIST, NON_INTERSECT);
+    float water = sphereIntersect(ro, rd, vec3(0.0, 0.0, 0.0), planetBaseSize).x;
+    if (water >= 0.0) {
+        item = vec2(water, WATER_INTERSECT);
+    }
+    float sun = sphereIntersect(ro, rd, light / 10.0, 0.35).x;
+    if ((sun >= 0.0) && (sun < item.x)) {
+        item = vec2(sun, SUN_INTERSECT);
+    }
+
+    vec2 shell = sphereIntersect(ro, rd, vec3(0.0, 0.0, 0.0), planetBaseSize + terrainMaxDisplace + EPSILON);
+    float t = max(shell.x, start);
+    float end = min(min(shell.y, item.x), MAX_DIST);
+
+    // Plain steps take the SDF as a distance, but displace() can change faster than the ray moves.
+    // The bounded modes divide by the Lipschitz constant so a step does not pass the surface (the noise
+    // part of terrainLipschitz is a measured maximum with headroom, not a proven bound), and the
+    // relaxed mode stretches each step until two consecutive unbounding spheres stop overlapping
+    // (Keinert et al. 2014, "Enhanced Sphere Tracing"), then steps back and continues unrelaxed
+    float lipschitz = (marchMode == MARCH_PLAIN) ? 1.0 : terrainLipschitz;
+    float omega = (marchMode == MARCH_RELAXED) ? MARCH_RELAXATION : 1.0;
+    float stepLength = 0.0;
+    float prevRadius = 0.0;
+    for (int i = 0; (i < MAX_STEPS) && (t < end); i++){
+        marchSteps++;
+        float radius = terrainSDF(ro + t * rd) / lipschitz; // get sdf
+        bool relaxFail = (omega > 1.0) && ((abs(radius) + prevRadius) < stepLength);
+        if (relaxFail) {
+            stepLength -= omega * stepLength;
+            omega = 1.0;
+        }
+        else {
+            stepLength = radius * omega;
+        }
+        prevRadius = abs(radius);
+        t += stepLength; // increment by distance
 
         // if hit
-        if ((abs(hit.x) < EPSILON) || (item.x > MAX_DIST)) {
+        if (!relaxFail && (abs(radius) < EPSILON)) {
             break;
         }
     }
-    return item;
+    // out of steps before leaving the shell counts as a hit if the ray ended up close to the surface
+    // (grazing rays), otherwise it was still crawling out of the shell (shadow rays) and missed
+    return ((t < end) && (prevRadius < 10.0 * EPSILON)) ? vec2(t, PLANET_INTERSECT) : item;
 }
 
-ItersectionDetails renderScene(vec3 ro, vec3 rd) {
+// Distance along the ray before which no terrain comes inside the cone of the given slope around it,
+// so every ray inside the cone can start marching there. Outside the terrain shell the distance to
+// the shell bounds the SDF, which saves fbm evaluations on the way in
+float coneMarch(vec3 ro, vec3 rd, float coneSlope) {
+    float shellRadius = planetBaseSize + terrainMaxDisplace + EPSILON;
+    float lipschitz = (marchMode == MARCH_PLAIN) ? 1.0 : terrainLipschitz;
+    float t = 0.0;
+    for (int i = 0; (i < MAX_STEPS) && (t < MAX_DIST); i++) {
+        marchSteps++;
+        vec3 pos = ro + t * rd;
+        float coneRadius = t * coneSlope;
+        float radius = length(pos) - shellRadius;
+        if (radius <= 2.0 * coneRadius) {
+            radius = max(radius, terrainSDF(pos) / lipschitz);
+        }
+        // steps shrink geometrically as the cone closes in, stopping early is always conservative
+        if (radius <= 2.0 * coneRadius) {
+            break;
+        }
+        // longest step that keeps the cone cross section inside the unbounding sphere
+        t += (radius - coneRadius) / (1.0 + coneSlope);
+    }
+    return t;
+}
+
+ItersectionDetails renderScene(vec3 ro, vec3 rd, float start) {
     ItersectionDetails ret;
 
     ret.type = NON_INTERSECT;
     ret.normal = vec3(0.0);
     ret.material.color = sky_color(ro, rd);
 
-    vec2 dist = rayMarch(ro, rd);
+    vec2 dist = rayMarch(ro, rd, start);
     float t = dist.x;
     if (t < MAX_DIST) {
         if (dist.y == WATER_INTERSECT) { // water
@@ -305,11 +524,7 @@ ItersectionDetails renderScene(vec3 ro, vec3 rd) {
                 normal = normalize(pos);
             }
             else {
-                const vec3 small_step = vec3(0.001, 0.0, 0.0);
-                float gradient_x = sphereSDF(pos + small_step.xyy, vec3(0.0, 0.0, 0.0), 1.0 + displace(pos + small_step.xyy)) - sphereSDF(pos - small_step.xyy, vec3(0.0, 0.0, 0.0), 1.0 + displace(pos - small_step.xyy));
-                float gradient_y = sphereSDF(pos + small_step.yxy, vec3(0.0, 0.0, 0.0), 1.0 + displace(pos + small_step.yxy)) - sphereSDF(pos - small_step.yxy, vec3(0.0, 0.0, 0.0), 1.0 + displace(pos - small_step.yxy));
-                float gradient_z = sphereSDF(pos + small_step.yyx, vec3(0.0, 0.0, 0.0), 1.0 + displace(pos + small_step.yyx)) - sphereSDF(pos - small_step.yyx, vec3(0.0, 0.0, 0.0), 1.0 + displace(pos - small_step.yyx));
-                normal = normalize(vec3(gradient_x, gradient_y, gradient_z));
+                normal = terrainNormal(pos);
             }
 
             ret.type            = WATER_INTERSECT;
@@ -328,11 +543,7 @@ ItersectionDetails renderScene(vec3 ro, vec3 rd) {
             vec3 pos = ro + t*rd;
 
             // calculate normal
-            const vec3 small_step = vec3(0.001, 0.0, 0.0);
-            float gradient_x = sphereSDF(pos + small_step.xyy, vec3(0.0, 0.0, 0.0), 1.0 + displace(pos + small_step.xyy)) - sphereSDF(pos - small_step.xyy, vec3(0.0, 0.0, 0.0), 1.0 + displace(pos - small_step.xyy));
-            float gradient_y = sphereSDF(pos + small_step.yxy, vec3(0.0, 0.0, 0.0), 1.0 + displace(pos + small_step.yxy)) - sphereSDF(pos - small_step.yxy, vec3(0.0, 0.0, 0.0), 1.0 + displace(pos - small_step.yxy));
-            float gradient_z = sphereSDF(pos + small_step.yyx, vec3(0.0, 0.0, 0.0), 1.0 + displace(pos + small_step.yyx)) - sphereSDF(pos - small_step.yyx, vec3(0.0, 0.0, 0.0), 1.0 + displace(pos - small_step.yyx));
-            vec3 normal = normalize(vec3(gradient_x, gradient_y, gradient_z));
+            vec3 normal = terrainNormal(pos);
 
             ret.type    = PLANET_INTERSECT;
             ret.pos     = pos;
@@ -426,6 +637,10 @@ ItersectionDetails renderScene(vec3 ro, vec3 rd) {
     return ret;
 }
 
+ItersectionDetails renderScene(vec3 ro, vec3 rd) {
+    return renderScene(ro, rd, 0.0);
+}
+
 /*
  * Shading the scene
  **/
@@ -492,7 +707,7 @@ vec3 shading(vec3 ro, vec3 rd, ItersectionDetails intersect) {
         light_color = lerp(light_color, reflectionIntersection.material.color, 1.0 - reflection_str);
         // soft shadows
         for (int i = 0; i < N_POINTS; i++){
-            vec3 p = random_sphere_point(i) * SMALL_SPHERES_RADIUS;
+            vec3 p = planetRotation * random_sphere_point(i) * SMALL_SPHERES_RADIUS;
 
             ItersectionDetails shadow_ret = renderScene(pos + 0.01 * ((p + light) / length(p + light)), (p + light) / length(p + light));
             if (shadow_ret.type != NON_INTERSECT){
@@ -511,14 +726,43 @@ vec3 shading(vec3 ro, vec3 rd, ItersectionDetails intersect) {
 }
 
 void main() {
-    // pixel offset
-    vec2 p  = vec2((2.0 * gl_FragCoord.x - iResolution.x) / iResolution.x, (2.0 * gl_FragCoord.y - iResolution.y) / iResolution.y);
+    // write raw displacement on a grid so GLState::verifyTerrain can compare it with the CPU port
+    // (offset so samples never sit exactly on a simplex cell boundary, where rounding picks the cell)
+    if (terrainReadback) {
+        vec3 p = vec3((gl_FragCoord.xy - 0.5) / 32.0 - 0.9871, 0.4137);
+        outCol = vec3(displace(planetRotation * p));
+        return;
+    }
+
+    // pixel offset, a prepass fragment stands for the center of a prepassFactor x prepassFactor block
+    vec2 fragCoord = depthPrepass ? gl_FragCoord.xy * float(prepassFactor) : gl_FragCoord.xy;
+    vec2 p  = vec2((2.0 * fragCoord.x - iResolution.x) / iResolution.x, (2.0 * fragCoord.y - iResolution.y) / iResolution.y);
     
     // ro = camera
     // rd = direction to center offset by frag coord
     vec3 ro = -2.0 * cameraPosition;
     vec3 rd = camTBNMat * normalize( vec3(p, -2.0) );
 
-    ItersectionDetails intersect = renderScene(ro, rd);
+    // trace in planet space, so the light (and sun) turn instead of every terrain sample
+    ro = planetRotation * ro;
+    rd = planetRotation * rd;
+    light = planetRotation * light;
+
+    if (depthPrepass) {
+        // the cone covers the whole block: half its diagonal in p units over the focal length of 2
+        float coneSlope = length(vec2(prepassFactor) / vec2(iResolution)) / 2.0;
+        outCol = vec3(coneMarch(ro, rd, coneSlope), float(marchSteps), 0.0);
+        return;
+    }
+
+    float start = 0.0;
+    if (prepassFactor > 0) {
+        start = texelFetch(prepassDepth, ivec2(gl_FragCoord.xy) / prepassFactor, 0).r;
+    }
+    ItersectionDetails intersect = renderScene(ro, rd, start);
     outCol = shading(ro, rd, intersect);
+
+    if (stepReadback) {
+        outCol = vec3(float(marchSteps));
+    }
 }
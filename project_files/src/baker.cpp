@@ -0,0 +1,93 @@
+#include "baker.hpp"
+
+TerrainBaker::TerrainBaker() : _cancel(false) {
+	_thread = std::thread(&TerrainBaker::_run, this);
+}
+
+TerrainBaker::~TerrainBaker() {
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_quit = true;
+		_cancel = true;
+	}
+	_wake.notify_one();
+	_thread.join();
+}
+
+void TerrainBaker::request(const TerrainEditor &terrain, int resolution, std::string diskDirectory) {
+	// Copy the edits before taking the lock, the worker only waits for the swap
+	std::vector<PackedMound> mounds = terrain.getMounds();
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_jobSeed = terrain.getSeed();
+		_jobDetail = terrain.getDetailLevel();
+		_jobMounds.swap(mounds);
+		_jobResolution = resolution;
+		_jobDirectory.swap(diskDirectory);
+		_hasJob = true;
+		_cancel = true; // Whatever is running now is out of date
+	}
+	_wake.notify_one();
+}
+
+bool TerrainBaker::poll(Heightfield &result, PlanetKey &key) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (!_hasResult) {
+		return false;
+	}
+	result = std::move(_result);
+	key = _resultKey;
+	_hasResult = false;
+	return true;
+}
+
+bool TerrainBaker::isBusy() {
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _hasJob || _running;
+}
+
+void TerrainBaker::_run() {
+	std::unique_lock<std::mutex> lock(_mutex);
+	while (true) {
+		_wake.wait(lock, [this]() { return _quit || _hasJob; });
+		if (_quit) {
+			return;
+		}
+
+		// Take the newest request and bake it without holding the lock
+		int seed = _jobSeed;
+		int detail = _jobDetail;
+		std::vector<PackedMound> mounds = std::move(_jobMounds);
+		int resolution = _jobResolution;
+		std::string directory = std::move(_jobDirectory);
+		_hasJob = false;
+		_running = true;
+		_cancel = false;
+		lock.unlock();
+
+		// A bake stored by an earlier run is read instead of baked, a new bake is stored
+		PlanetKey key = { seed, detail, TerrainEditor::hashEdits(mounds.data(), mounds.size()), resolution };
+		Heightfield field;
+		bool finished = PlanetCache::loadFromDisk(directory, key, field);
+		if (!finished) {
+			TerrainEditor terrain;
+			terrain.setSeed(seed);
+			terrain.setDetail(detail);
+			terrain.setMounds(std::move(mounds)); // Builds the mound index, the edit field stays off
+			finished = terrain.generate(resolution, &_cancel);
+			if (finished) {
+				field = terrain.takeHeightfield();
+				PlanetCache::saveToDisk(directory, key, field);
+			}
+		}
+
+		lock.lock();
+		_running = false;
+		// Drop the bake if it was cancelled or a newer request arrived meanwhile
+		if (finished && !_hasJob) {
+			_result = std::move(field);
+			_resultKey = key;
+			_hasResult = true;
+		}
+	}
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "procedural.hpp"
+#include "planetcache.hpp"
+
+// Bakes heightfields on a background thread so terrain changes never stall the render loop.
+// Only the newest request matters: a new request replaces any queued one and cancels the bake in flight.
+// With a disk directory the thread also reads a stored bake instead of baking, and stores new bakes
+class TerrainBaker
+{
+public:
+	TerrainBaker();
+	~TerrainBaker();
+	// Disallow copy, move, & assignment
+	TerrainBaker(const TerrainBaker& other) = delete;
+	TerrainBaker& operator=(const TerrainBaker& other) = delete;
+
+	void request(const TerrainEditor &terrain, int resolution, std::string diskDirectory = ""); // Bake a snapshot of the terrain's seed, detail and edits, see PlanetCache::getDiskDirectory
+	bool poll(Heightfield &result, PlanetKey &key); // Take a finished bake and the planet it belongs to, if any
+	bool isBusy(); // Bake queued or running
+
+private:
+	void _run(); // Worker thread loop
+
+	std::thread _thread;
+	std::mutex _mutex;
+	std::condition_variable _wake;
+	std::atomic<bool> _cancel;	// Set when the running bake became stale
+	bool _quit = false;
+	bool _running = false;
+
+	// Queued request, only what generate() reads
+	bool _hasJob = false;
+	int _jobSeed = 0;
+	int _jobDetail = 0;
+	std::vector<PackedMound> _jobMounds = {};
+	int _jobResolution = 0;
+	std::string _jobDirectory = "";
+
+	// Finished bake waiting for the GL thread
+	bool _hasResult = false;
+	Heightfield _result;
+	PlanetKey _resultKey;
+};
@@ -0,0 +1,378 @@
+#include "bench.hpp"
+#include "glstate.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#ifndef _WIN32
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+
+/*####################
+####    Script    ####
+####################*/
+
+BenchScript loadBenchScript(std::string filename) {
+	std::ifstream f(filename);
+	if (!f.is_open()) {
+		throw std::runtime_error("Failed to open file: " + filename);
+	}
+
+	BenchScript script;
+	std::string line;
+	int lineNumber = 0;
+	auto fail = [&](std::string message) {
+		throw std::runtime_error(filename + ":" + std::to_string(lineNumber) + ": " + message);
+	};
+	auto segment = [&]() -> BenchSegment & {
+		if (script.segments.empty()) {
+			fail("setting before the first 'segment' line");
+		}
+		return script.segments.back();
+	};
+	auto flag = [&](std::istringstream &args) {
+		int value;
+		if (!(args >> value) || ((value != 0) && (value != 1))) {
+			fail("expected 0 or 1");
+		}
+		return value == 1;
+	};
+
+	while (std::getline(f, line)) {
+		lineNumber++;
+		line = line.substr(0, line.find('#'));
+		std::istringstream args(line);
+		std::string key;
+		if (!(args >> key)) {
+			continue;
+		}
+
+		if (key == "resolution") {
+			if (!(args >> script.width >> script.height) || (script.width <= 0) || (script.height <= 0)) {
+				fail("expected 'resolution <width> <height>'");
+			}
+		}
+		else if (key == "warmup") {
+			if (!(args >> script.warmup) || (script.warmup < 0)) {
+				fail("expected 'warmup <frames>'");
+			}
+		}
+		else if (key == "edits") {
+			if (!(args >> script.edits)) {
+				fail("expected 'edits <config file>'");
+			}
+		}
+		else if (key == "segment") {
+			// Later segments start where the previous one ended
+			BenchSegment next;
+			if (!script.segments.empty()) {
+				next = script.segments.back();
+				next.cameraFrom = next.cameraTo;
+				next.rotationFrom = next.rotationTo;
+			}
+			if (!(args >> next.name >> next.frames) || (next.frames <= 0)) {
+				fail("expected 'segment <name> <frames>'");
+			}
+			script.segments.push_back(next);
+		}
+		else if (key == "camera") {
+			BenchSegment &s = segment();
+			glm::vec3 from, to;
+			if (!(args >> from.x >> from.y >> from.z) || (glm::length(from) <= 0.0f)) {
+				fail("expected 'camera <x> <y> <z> [<x> <y> <z>]'");
+			}
+			to = (args >> to.x >> to.y >> to.z) ? to : from;
+			s.cameraFrom = from;
+			s.cameraTo = to;
+		}
+		else if (key == "rotation") {
+			BenchSegment &s = segment();
+			glm::vec2 from, to;
+			if (!(args >> from.x >> from.y)) {
+				fail("expected 'rotation <x> <y> [<x> <y>]'");
+			}
+			to = (args >> to.x >> to.y) ? to : from;
+			s.rotationFrom = from;
+			s.rotationTo = to;
+		}
+		else if (key == "seed") {
+			if (!(args >> segment().seed)) {
+				fail("expected 'seed <n>'");
+			}
+		}
+		else if (key == "detail") {
+			if (!(args >> segment().detail)) {
+				fail("expected 'detail <n>'");
+			}
+		}
+		else if (key == "march") {
+			std::string mode;
+			args >> mode;
+			int m = 0;
+			while ((m < GLState::MARCH_MODE_COUNT) && (mode != std::string(GLState::marchModeName(m)).substr(0, mode.size()))) {
+				m++;
+			}
+			if (mode.empty() || (m == GLState::MARCH_MODE_COUNT)) {
+				fail("expected 'march plain|Lipschitz|over-relaxed'");
+			}
+			segment().marchMode = m;
+		}
+		else if (key == "performance") {
+			segment().performanceMode = flag(args);
+		}
+		else if (key == "hardshadows") {
+			segment().hardShadows = flag(args);
+		}
+		else if (key == "prepass") {
+			segment().depthPrepass = flag(args);
+		}
+		else if (key == "baked") {
+			segment().bakedTerrain = flag(args);
+		}
+		else if (key == "splat") {
+			segment().splatEdits = flag(args);
+		}
+		else {
+			fail("unknown setting '" + key + "'");
+		}
+	}
+
+	if (script.segments.empty()) {
+		throw std::runtime_error(filename + ": no segments");
+	}
+	return script;
+}
+
+
+/*####################
+####    Context   ####
+####################*/
+
+void createHeadlessContext() {
+#ifdef _WIN32
+	throw std::runtime_error("--bench needs a surfaceless EGL context, which is not available on Windows");
+#else
+	// Surfaceless Mesa display, no window system or GPU needed
+	EGLDisplay display = eglGetPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+	EGLint major, minor;
+	if ((display == EGL_NO_DISPLAY) || !eglInitialize(display, &major, &minor)) {
+		throw std::runtime_error("Failed to initialize a surfaceless EGL display");
+	}
+	if (!eglBindAPI(EGL_OPENGL_API)) {
+		throw std::runtime_error("EGL display does not support desktop OpenGL");
+	}
+
+	// Same version and profile the GLUT window asks for
+	const EGLint attributes[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 3,
+		EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+	EGLContext context = eglCreateContext(display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, attributes);
+	if ((context == EGL_NO_CONTEXT) || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+		throw std::runtime_error("Failed to create a surfaceless OpenGL 3.3 core context");
+	}
+#endif
+}
+
+
+/*####################
+####      Run     ####
+####################*/
+
+// Nearest rank percentile of sorted values
+static double percentile(const std::vector<double> &sorted, double p) {
+	size_t rank = (size_t)std::ceil(p / 100.0 * sorted.size());
+	return sorted[std::min(std::max(rank, (size_t)1), sorted.size()) - 1];
+}
+
+void runBenchmark(GLState &state, const BenchScript &script, std::string resultsCsv) {
+	// Offscreen target at the fixed resolution, paintGL blits into whatever is bound
+	GLuint fbo, color;
+	glGenRenderbuffers(1, &color);
+	glBindRenderbuffer(GL_RENDERBUFFER, color);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, script.width, script.height);
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+	state.resizeGL(script.width, script.height);
+
+	// Every frame is drawn in full at the script resolution
+	state.dynamicResolution = false;
+	if (!script.edits.empty()) {
+		state.planet.terrain.load(script.edits);
+	}
+
+	struct Result {
+		std::vector<double> frameMs;	// Wall time of paintGL including glFinish
+		std::vector<uint64_t> frames;	// Profiler frame indices, for GPU times
+	};
+	std::vector<Result> results(script.segments.size());
+
+	for (size_t s = 0; s < script.segments.size(); s++) {
+		const BenchSegment &segment = script.segments[s];
+		state.planet.terrain.setSeed(segment.seed);
+		state.planet.terrain.setDetail(segment.detail);
+		state.performanceMode = segment.performanceMode;
+		state.hardShadows = segment.hardShadows;
+		state.marchMode = segment.marchMode;
+		state.depthPrepass = segment.depthPrepass;
+		state.bakedTerrain = segment.bakedTerrain;
+		state.splatEdits = segment.splatEdits;
+		state.planet.rotationVelocity = glm::vec2(0.0f);
+
+		// Shader compiles and bakes are not part of the frame time
+		state.precompileShaders(false);
+		auto bakeStart = std::chrono::steady_clock::now();
+		while (!state.bakedTerrainReady()) {
+			if (std::chrono::steady_clock::now() - bakeStart > std::chrono::minutes(5)) {
+				throw std::runtime_error("Timed out waiting for the terrain bake of segment " + segment.name);
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+
+		for (int i = -script.warmup; i < segment.frames; i++) {
+			// Camera distance and direction are interpolated separately, so orbits stay orbits
+			float t = (segment.frames > 1) ? (float)std::max(i, 0) / (float)(segment.frames - 1) : 0.0f;
+			float distance = glm::mix(glm::length(segment.cameraFrom), glm::length(segment.cameraTo), t);
+			glm::vec3 direction = glm::mix(glm::normalize(segment.cameraFrom), glm::normalize(segment.cameraTo), t);
+			if (glm::length(direction) < 1e-4f) {
+				throw std::runtime_error("Camera path of segment " + segment.name + " passes through the planet center, split it");
+			}
+			state.cam.setPosition(glm::normalize(direction) * distance);
+			state.planet.rotationRad = glm::mix(segment.rotationFrom, segment.rotationTo, t);
+			state.requestRedraw();
+
+			auto start = std::chrono::steady_clock::now();
+			state.paintGL();
+			glFinish();
+			double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			uint64_t frame = state.profiler.current()->index;
+			state.profiler.endFrame();
+
+			if (i >= 0) {
+				results[s].frameMs.push_back(ms);
+				results[s].frames.push_back(frame);
+			}
+		}
+	}
+
+	// All queries are done after glFinish
+	state.profiler.poll();
+	std::map<uint64_t, double> gpuMs;
+	for (const FrameProfiler::Frame &frame : state.profiler.getHistory()) {
+		double total = 0.0;
+		for (double ms : frame.gpuMs) {
+			total += std::max(ms, 0.0);
+		}
+		gpuMs[frame.index] = total;
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &fbo);
+	glDeleteRenderbuffers(1, &color);
+
+	// Report, one row per segment plus all frames together
+	std::ofstream csv;
+	if (!resultsCsv.empty()) {
+		csv.open(resultsCsv, std::ofstream::out | std::ofstream::trunc);
+		if (!csv.is_open()) {
+			throw std::runtime_error("Failed to open file: " + resultsCsv);
+		}
+		csv << "segment,frames,mean_ms,p50_ms,p95_ms,p99_ms,max_ms,gpu_p50_ms\n";
+	}
+	printf("\nBenchmark %dx%d, frame times in ms (paintGL + glFinish)\n", script.width, script.height);
+	printf("%-16s %7s %9s %9s %9s %9s %9s %9s\n", "segment", "frames", "mean", "p50", "p95", "p99", "max", "gpu p50");
+
+	Result all;
+	for (size_t s = 0; s <= results.size(); s++) {
+		const Result &r = (s < results.size()) ? results[s] : all;
+		std::string name = (s < results.size()) ? script.segments[s].name : "all";
+		if (s < results.size()) {
+			all.frameMs.insert(all.frameMs.end(), r.frameMs.begin(), r.frameMs.end());
+			all.frames.insert(all.frames.end(), r.frames.begin(), r.frames.end());
+		}
+
+		std::vector<double> sorted = r.frameMs;
+		std::sort(sorted.begin(), sorted.end());
+		std::vector<double> gpu;
+		for (uint64_t frame : r.frames) {
+			if (gpuMs.count(frame)) {
+				gpu.push_back(gpuMs[frame]);
+			}
+		}
+		std::sort(gpu.begin(), gpu.end());
+		double mean = 0.0;
+		for (double ms : sorted) {
+			mean += ms / sorted.size();
+		}
+		double gpuP50 = gpu.empty() ? -1.0 : percentile(gpu, 50.0);
+
+		printf("%-16s %7zu %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f\n", name.c_str(), sorted.size(), mean,
+			percentile(sorted, 50.0), percentile(sorted, 95.0), percentile(sorted, 99.0), sorted.back(), gpuP50);
+		if (csv.is_open()) {
+			csv << name << "," << sorted.size() << "," << mean << "," << percentile(sorted, 50.0) << "," << percentile(sorted, 95.0)
+				<< "," << percentile(sorted, 99.0) << "," << sorted.back() << "," << gpuP50 << "\n";
+		}
+	}
+}
+
+
+/*####################
+####     Load     ####
+####################*/
+
+void runLoadBenchmark(size_t mounds, std::string filename) {
+	// Random mounds of the sizes placement mode makes, saved like 'ctrl + s' does
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+	TerrainEditor terrain;
+	for (size_t i = 0; i < mounds; i++) {
+		glm::vec3 center;
+		do {
+			center = glm::vec3(unit(rng), unit(rng), unit(rng));
+		} while ((glm::length(center) > 1.0f) || (glm::length(center) < 0.01f));
+		terrain.addTerrain(glm::normalize(center), 0.05f + 0.45f * std::abs(unit(rng)), 0.1f * unit(rng));
+	}
+	terrain.save(filename);
+
+	std::ifstream f(filename, std::ifstream::in | std::ifstream::binary);
+	std::vector<char> data((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+	f.close();
+
+	// Parsing alone, then the whole load ('r'): file read, parse, mound index
+	const int runs = 5;
+	std::vector<double> parseMs, loadMs;
+	for (int run = 0; run < runs; run++) {
+		auto start = std::chrono::steady_clock::now();
+		std::vector<PackedMound> parsed = TerrainEditor::parseConfig(data.data(), data.size(), filename);
+		auto parsedTime = std::chrono::steady_clock::now();
+		TerrainEditor loaded;
+		loaded.load(filename);
+		auto loadedTime = std::chrono::steady_clock::now();
+		if ((parsed != terrain.getMounds()) || (loaded.getMounds() != terrain.getMounds())) {
+			throw std::runtime_error("Loaded mounds differ from the saved ones");
+		}
+		parseMs.push_back(std::chrono::duration<double, std::milli>(parsedTime - start).count());
+		loadMs.push_back(std::chrono::duration<double, std::milli>(loadedTime - parsedTime).count());
+	}
+	std::remove(filename.c_str());
+	std::sort(parseMs.begin(), parseMs.end());
+	std::sort(loadMs.begin(), loadMs.end());
+
+	double megabytes = (double)data.size() / (1024.0 * 1024.0);
+	printf("Loaded %zu mounds (%.1f MB), median of %d runs\n", mounds, megabytes, runs);
+	printf("  parse  %9.2f ms  %7.1f MB/s\n", parseMs[runs / 2], megabytes / (parseMs[runs / 2] / 1000.0));
+	printf("  load   %9.2f ms  (read, parse, mound index and edit field)\n", loadMs[runs / 2]);
+}
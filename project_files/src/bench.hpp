@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+class GLState;
+
+// One stretch of a benchmark path. Camera and planet rotation are interpolated from the first to
+// the second value over the segment's frames, everything else is fixed for the segment.
+struct BenchSegment
+{
+	std::string name;
+	int frames = 30;
+	glm::vec3 cameraFrom = glm::vec3(0.0f, 0.0f, 2.0f), cameraTo = glm::vec3(0.0f, 0.0f, 2.0f);
+	glm::vec2 rotationFrom = glm::vec2(0.0f), rotationTo = glm::vec2(0.0f);	// PlanetSphere::rotationRad
+	int seed = 0;
+	int detail = 5;
+	bool performanceMode = true;
+	bool hardShadows = true;
+	int marchMode = 0;			// GLState::MarchMode
+	bool depthPrepass = true;
+	bool bakedTerrain = false;
+	bool splatEdits = true;
+};
+
+// Benchmark script, see bench.txt for the format
+struct BenchScript
+{
+	int width = 512, height = 512;
+	int warmup = 3;				// Untimed frames before each segment
+	std::string edits = "";		// Terrain edit config loaded before the run, none if empty
+	std::vector<BenchSegment> segments = {};
+};
+
+BenchScript loadBenchScript(std::string filename); // Throws with the line number on errors
+void createHeadlessContext(); // Surfaceless EGL context, so benchmarks run without a window (also on llvmpipe)
+void runBenchmark(GLState &state, const BenchScript &script, std::string resultsCsv = ""); // Print p50/p95/p99 frame times per segment
+void runLoadBenchmark(size_t mounds, std::string filename = "bench_load.txt"); // Save that many random mounds, then time loading them back
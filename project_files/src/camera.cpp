@@ -56,10 +56,19 @@ void Camera::rotate(glm::vec2 mousePos) {
 			_pos.x = newPos.x;
 			_pos.y = newPos.y;
 			_pos.z = newPos.z;
+			_revision++;
 		}
 	}
 }
 
+void Camera::setPosition(glm::vec3 position) {
+	if ((position != _pos) && (glm::length(position) > FLT_EPSILON)) {
+		_pos = position;
+		_recalcUpAndTangent();
+		_revision++;
+	}
+}
+
 void Camera::startRotation(glm::vec2 mousePos) {
 	isRotating = true;
 	_initPos = _pos;
@@ -74,6 +83,7 @@ void Camera::zoom(float amount) {
 	glm::vec3 newPos = _pos * (1.0f + amount);
 	if ((glm::length(newPos) < 10.0f) && (glm::length(newPos) > 0.556f)) {
 		_pos = newPos;
+		_revision++;
 	}
 }
 
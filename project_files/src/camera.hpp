@@ -34,10 +34,12 @@ public:
 
     void rotate(glm::vec2 mousePos);                                        // Rotate camera about (0, 0, 0)
     void zoom(float amount);                                                // Zoom camera in or out
+    void setPosition(glm::vec3 position);                                   // Jump to a position, e.g. for scripted paths
     void startRotation(glm::vec2 mousePos);                                 // On rotation start
     void endRotation();                                                     // On rotation complete
     inline glm::ivec2 getSize() { return glm::ivec2(_width, _height); }
     inline glm::vec3 getCoords() { return _pos; }
+    inline unsigned int getRevision() { return _revision; }                // Changes whenever the camera moves
     
 private:
     void _recalcUpAndTangent();                                             // Recalculate the up and tangent vectors
@@ -54,5 +56,6 @@ private:
     glm::vec3 _initPos;                                                     // Initial rotation
     glm::vec2 _initMousePos;                                                // Initial mouse position
     float _zoomAmount = 0.5f;                                               // Current zoom amount
+    unsigned int _revision = 0;                                             // Bumped by every rotate or zoom that moves the camera
 };
 
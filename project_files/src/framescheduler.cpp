@@ -0,0 +1,83 @@
+#include "framescheduler.hpp"
+#include <algorithm>
+#include <thread>
+
+FrameScheduler::FrameScheduler(double targetFps) {
+	setTargetFps(targetFps);
+	_start = Clock::now();
+	_nextFrame = _start;
+}
+
+void FrameScheduler::setTargetFps(double fps) {
+	_targetMs = 1000.0 / std::max(fps, 1.0);
+}
+
+FrameScheduler::Clock::time_point FrameScheduler::_wakeTime() {
+	// With vsync the swap itself waits for the next vertical blank. Start that much earlier,
+	// otherwise the sleep and the swap wait add up and every other refresh is missed
+	double leadMs = _vsync ? _swapMs : 0.0;
+	return _nextFrame - std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(leadMs));
+}
+
+bool FrameScheduler::frameDue() {
+	return Clock::now() >= _wakeTime();
+}
+
+void FrameScheduler::waitForFrame() {
+	// sleep_until may oversleep by the OS timer granularity, which only delays this one frame,
+	// the next deadline is still computed from the target
+	std::this_thread::sleep_until(_wakeTime());
+}
+
+void FrameScheduler::beginSwap() {
+	_swapStart = Clock::now();
+}
+
+void FrameScheduler::endSwap() {
+	Clock::time_point now = Clock::now();
+	double swapMs = std::chrono::duration<double, std::milli>(now - _swapStart).count();
+	_swapMs = _presented ? 0.9 * _swapMs + 0.1 * swapMs : swapMs;
+
+	if (_presented) {
+		float interval = (float)std::chrono::duration<double, std::milli>(now - _lastPresent).count();
+		_intervals.push_back(interval);
+		if (_intervals.size() > maxIntervals) {
+			_intervals.pop_front();
+		}
+		// A driver pacing to vsync spends a large, steady part of each frame inside the swap
+		_vsync = (_swapMs > 1.0) && (_swapMs > 0.25 * getAverageFrameInterval());
+	}
+	_lastPresent = now;
+	_presented = true;
+	_advance(now);
+}
+
+void FrameScheduler::pause() {
+	_presented = false;
+	_advance(Clock::now());
+}
+
+void FrameScheduler::_advance(Clock::time_point now) {
+	// Next deadline one frame after the last one. After a stall (or a long idle with nothing to
+	// draw) restart from now instead of drawing a burst of frames to catch up
+	Clock::duration target = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(_targetMs));
+	_nextFrame += target;
+	if (_nextFrame < now) {
+		_nextFrame = now + target;
+	}
+}
+
+double FrameScheduler::getElapsed() {
+	return std::chrono::duration<double, std::milli>(Clock::now() - _start).count();
+}
+
+double FrameScheduler::getAverageFrameInterval() {
+	if (_intervals.empty()) {
+		return _targetMs;
+	}
+	double total = 0.0;
+	for (float i : _intervals) {
+		total += i;
+	}
+	return total / (double)_intervals.size();
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <chrono>
+#include <deque>
+
+// Paces redraws to a target frame time on the monotonic steady_clock. idle() asks frameDue()
+// and sleeps with waitForFrame() in between, display() brackets the buffer swap so the scheduler
+// can tell when the driver is already blocking on vsync and wake up early enough for it.
+class FrameScheduler
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	FrameScheduler(double targetFps = 60.0);
+
+	void setTargetFps(double fps);
+	inline double getTargetFrameTime() { return _targetMs; } // Milliseconds
+
+	bool frameDue();			// Is it time to start the next frame?
+	void waitForFrame();		// Sleep until frameDue() (returns immediately if it already is)
+	void beginSwap();			// Call right before swapping buffers
+	void endSwap();				// Call right after, records the frame interval
+	void pause();				// Nothing to draw, the gap until the next frame is not a frame interval
+	double getElapsed();		// Milliseconds since construction, for GLState::updateTime
+
+	// Measured intervals between presented frames, oldest first, in milliseconds
+	inline const std::deque<float> &getFrameIntervals() { return _intervals; }
+	double getAverageFrameInterval();
+	inline bool isVsyncDetected() { return _vsync; }	// Swaps block long enough that the driver paces frames
+
+	static const size_t maxIntervals = 120; // About 2 seconds at 60 fps
+
+private:
+	Clock::time_point _wakeTime();	// Deadline minus the expected swap wait
+	void _advance(Clock::time_point now);	// Move the deadline to the next frame
+
+	double _targetMs;
+	Clock::time_point _start;
+	Clock::time_point _nextFrame;	// When the next frame should be presented
+	Clock::time_point _swapStart;
+	Clock::time_point _lastPresent;
+	bool _presented = false;		// _lastPresent is valid
+	double _swapMs = 0.0;			// Smoothed time spent blocked in the buffer swap
+	bool _vsync = false;
+	std::deque<float> _intervals = {};
+};
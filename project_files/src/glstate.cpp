@@ -4,41 +4,80 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtx/transform.hpp>
 #include "util.hpp"
+#include "noise.hpp"
+#include "planetfile.hpp"
 #include <iostream>
+#include <algorithm>
 #include <chrono>  // for high_resolution_clock
 #include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <tuple>
 
 int GLState::width = 800;
 int GLState::height = 800;
 
+// Binding point of the uniform block in f.glsl, set on every program in buildShader
+static const GLuint frameUniformsBinding = 0;
+
 
 /*####################
 ####  Constructor ####
 ####################*/
 
 GLState::GLState() :
+	currentTime(0.0f),
+	performanceMode(true),
+	hardShadows(true),
+	marchMode(MARCH_PLAIN),
+	depthPrepass(true),
+	prepassFactor(4),
+	dynamicResolution(true),
+	renderScale(1.0f),
+	minRenderScale(0.5f),
+	gpuFrameBudget(0.8f),
+	bakedTerrain(false),
+	bakeResolution(512),
+	splatEdits(true),
+	editFieldResolution(512),
+	placementMode(false),
 	// states of the platform:
 	lineShader(0),
-	camPosLoc(0),
-	camTBNMatLoc(0),
-	planetRotRadLoc(0),
-	noiseOffsetLoc(0),
-	fbmIterationsLoc(0),
-	performanceModeLoc(0),
-	pArrayLoc(0),
-	rArrayLoc(0),
-	hArrayLoc(0),
-	numPointsLoc(0),
 	lineVao(0),
 	lineVbuf(0),
 	lineIbuf(0),
-	hardShadLoc(0),
-	iResolution_uniform_loc(-1),
-	iResolution(glm::ivec2(0)),
-	performanceMode(true),
-	hardShadows(true),
-	placementMode(false),
-	currentTime(0.0f)
+	terrainReadbackLoc(0),
+	terrainCubemapLoc(0),
+	stepReadbackLoc(0),
+	depthPrepassLoc(0),
+	prepassDepthLoc(0),
+	frameUbo(0),
+	uploadedFrame(),
+	frameUboValid(false),
+	moundBuffer(GL_RGBA16I, sizeof(PackedMound)),
+	moundIndexBuffer(GL_R32UI, sizeof(uint32_t)),
+	uploadedEditRevision(0),
+	editsValid(false),
+	editCubemap(0),
+	editCubemapResolution(0),
+	prepassFbo(0),
+	prepassTex(0),
+	prepassWidth(0),
+	prepassHeight(0),
+	frameFbo(0),
+	frameTex(0),
+	frameWidth(0),
+	frameHeight(0),
+	frameValid(false),
+	drawnFrame(),
+	drawnWidth(0),
+	drawnHeight(0),
+	bakedCubemap(0),
+	bakedMaxHeight(0.0f),
+	currentKeyRevision(0),
+	currentKeyValid(false),
+	bakeRequested(false)
 {
 }
 
@@ -48,10 +87,17 @@ GLState::GLState() :
 
 GLState::~GLState() {
 	// Release OpenGL resources
-	if (lineShader)	glDeleteProgram(lineShader);
+	for (auto &variant : shaderVariants)
+		glDeleteProgram(variant.second);
 	if (lineVao)	glDeleteVertexArrays(1, &lineVao);
 	if (lineVbuf)	glDeleteBuffers(1, &lineVbuf);
 	if (lineIbuf)	glDeleteBuffers(1, &lineIbuf);
+	if (prepassFbo)	glDeleteFramebuffers(1, &prepassFbo);
+	if (prepassTex)	glDeleteTextures(1, &prepassTex);
+	if (frameFbo)	glDeleteFramebuffers(1, &frameFbo);
+	if (frameTex)	glDeleteTextures(1, &frameTex);
+	if (frameUbo)	glDeleteBuffers(1, &frameUbo);
+	if (editCubemap)	glDeleteTextures(1, &editCubemap);
 }
 
 
@@ -64,10 +110,12 @@ void GLState::initializeGL() {
 	glClearColor(0.2f, 0.2f, 0.2f, 1.0f);
 	glClearDepth(1.0f);
 	glEnable(GL_DEPTH_TEST);
+	glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS); // Filter baked terrain across cube faces
 
 	// Initialize OpenGL state
 	initShaders();
 	initLineGeometry();
+	initUniformBuffers();
 }
 
 /*####################
@@ -75,77 +123,518 @@ void GLState::initializeGL() {
 ####################*/
 // Called when window requests a screen redraw
 void GLState::paintGL() {
+	profiler.beginFrame();
+	FrameProfiler::ScopedTimer paintTimer(profiler, FrameProfiler::CPU_PAINT);
+
+	// Redraw into the frame cache only if something changed, then copy it to the window. Static
+	// frames (expose events, mouse moves that did not move anything) cost one blit
+	GLint target;
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &target);
+	bool changed = sceneChanged();
+	bool redraw = changed || !frameValid || (drawnWidth != width) || (drawnHeight != height);
+	if (redraw) {
+		// Changed frames use the dynamic scale, a frame that stopped changing is redrawn at full size
+		float scale = (changed && dynamicResolution) ? renderScale : 1.0f;
+		int w = std::max(1, (int)(width * scale + 0.5f));
+		int h = std::max(1, (int)(height * scale + 0.5f));
+
+		if (!frameFbo || (frameWidth != width) || (frameHeight != height)) {
+			if (frameFbo) {
+				glDeleteFramebuffers(1, &frameFbo);
+				glDeleteTextures(1, &frameTex);
+			}
+			createRenderTarget(width, height, GL_RGBA8, frameTex, frameFbo);
+			frameWidth = width;
+			frameHeight = height;
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, frameFbo);
+		// The planet spins one tick per drawn frame. Readback draws (measureMarchSteps) leave it where it is
+		planet.updateRotation();
+		drawScene(w, h);
+		if (changed) {
+			lastChangedFrame = FrameScheduler::Clock::now();
+		}
+		drawnFrame = frameState();
+		drawnWidth = w;
+		drawnHeight = h;
+		frameValid = true;
+	}
+
+	// Counters for this frame
+	FrameProfiler::Frame *frame = profiler.current();
+	frame->redrawn = redraw;
+	frame->changed = changed;
+	frame->width = width;
+	frame->height = height;
+	frame->renderWidth = drawnWidth;
+	frame->renderHeight = drawnHeight;
+	frame->detail = planet.terrain.getDetailLevel();
+	frame->edits = (int)planet.terrain.getAddedTerrainArraySize();
+	frame->marchMode = marchMode;
+	frame->performanceMode = performanceMode;
+	frame->hardShadows = hardShadows;
+	frame->bakedTerrain = bakedTerrain && (bakedCubemap != 0);
+	frame->splatEdits = splatEdits;
+	frame->depthPrepass = depthPrepass;
+
+	// GPU times of earlier frames, never waits for this one. Only changed frames feed the scale
+	// decision, the full size refresh is a one-off
+	for (const FrameProfiler::Frame &done : profiler.poll()) {
+		double traceMs = done.gpuMs[FrameProfiler::GPU_TRACE];
+		if (done.changed && (traceMs >= 0.0)) {
+			double prepassMs = std::max(done.gpuMs[FrameProfiler::GPU_PREPASS], 0.0);
+			updateRenderScale(prepassMs + traceMs, (float)done.renderWidth / (float)done.width);
+		}
+	}
+
+	profiler.beginGpu(FrameProfiler::GPU_BLIT);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, frameFbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target);
+	glBlitFramebuffer(0, 0, drawnWidth, drawnHeight, 0, 0, width, height, GL_COLOR_BUFFER_BIT,
+		((drawnWidth == width) && (drawnHeight == height)) ? GL_NEAREST : GL_LINEAR);
+	profiler.endGpu(FrameProfiler::GPU_BLIT);
+	glBindFramebuffer(GL_FRAMEBUFFER, target);
+	glViewport(0, 0, width, height);
+}
+
+void GLState::updateRenderScale(double gpuMs, float scale) {
+	if (!dynamicResolution) {
+		return;
+	}
+
+	// Fragment cost grows with the pixel count, estimate what the frame costs at full size. This
+	// keeps measurements taken at older scales usable. The median ignores one-off spikes such as
+	// the first draw after a shader compile
+	scaleSamples.push_back(gpuMs / (double)(scale * scale));
+	if (scaleSamples.size() < 5) {
+		return;
+	}
+	std::nth_element(scaleSamples.begin(), scaleSamples.begin() + 2, scaleSamples.end());
+	double fullMs = scaleSamples[2];
+	scaleSamples.clear();
+
+	// Shrink when over budget, grow only when well under it, aim for the middle of that band
+	double budget = frameScheduler.getTargetFrameTime() * gpuFrameBudget;
+	double expected = fullMs * renderScale * renderScale;
+	if ((expected > budget) || (expected < 0.7 * budget)) {
+		float newScale = glm::clamp((float)std::sqrt(0.85 * budget / fullMs), minRenderScale, 1.0f);
+		newScale = std::round(newScale * 32.0f) / 32.0f;
+		renderScale = std::max(newScale, minRenderScale);
+	}
+}
+
+GLState::FrameState GLState::frameState() {
+	FrameState state;
+	state.camRevision = cam.getRevision();
+	state.planetRevision = planet.getRevision();
+	state.terrainRevision = planet.terrain.getRevision();
+	state.bakedCubemap = bakedCubemap;
+	state.bakedTerrain = bakedTerrain;
+	state.splatEdits = splatEdits;
+	state.performanceMode = performanceMode;
+	state.hardShadows = hardShadows;
+	state.marchMode = marchMode;
+	state.depthPrepass = depthPrepass;
+	state.prepassFactor = prepassFactor;
+	state.width = width;
+	state.height = height;
+	return state;
+}
+
+bool GLState::FrameState::operator==(const FrameState &o) const {
+	return std::tie(camRevision, planetRevision, terrainRevision, bakedCubemap, bakedTerrain, splatEdits, performanceMode, hardShadows, marchMode, depthPrepass, prepassFactor, width, height)
+		== std::tie(o.camRevision, o.planetRevision, o.terrainRevision, o.bakedCubemap, o.bakedTerrain, o.splatEdits, o.performanceMode, o.hardShadows, o.marchMode, o.depthPrepass, o.prepassFactor, o.width, o.height);
+}
+
+bool GLState::bakedTerrainReady() {
+	updateBakedTerrain();
+	return !bakedTerrain || (bakedCubemap && (bakedKey == currentKey));
+}
+
+bool GLState::sceneChanged() {
+	// Swaps in a finished bake, which changes bakedCubemap
+	updateBakedTerrain();
+	return !frameValid || planet.isSpinning() || !(frameState() == drawnFrame);
+}
+
+bool GLState::needsRedraw() {
+	if (sceneChanged()) {
+		return true;
+	}
+	// Scaled down frame that stayed unchanged for a moment, show it sharp. The delay keeps short
+	// pauses while dragging from triggering a full size draw
+	bool scaled = (drawnWidth != width) || (drawnHeight != height);
+	return scaled && (std::chrono::duration<double, std::milli>(FrameScheduler::Clock::now() - lastChangedFrame).count() > 250.0);
+}
+
+// Draw the scene into the bound framebuffer
+void GLState::drawScene(int w, int h) {
+	FrameProfiler::ScopedTimer sceneTimer(profiler, FrameProfiler::CPU_SCENE);
+
 	// Clear the color and depth buffers
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 	// Set shader to draw with
+	selectShader();
 	glUseProgram(lineShader);
+	glViewport(0, 0, w, h);
 
-	// Send resolution to shader
-	glUniform2i(iResolution_uniform_loc, width, height);
-
-	// Send camera position, tbn, and planet rotation to shader
-	glm::vec3 camCoords = cam.getCoords();
-	glm::mat3 tbn = cam.getTBNMatrix();
-	glUniform3f(camPosLoc, camCoords.x, camCoords.y, camCoords.z);
-	glUniformMatrix3fv(camTBNMatLoc, 1, GL_FALSE, glm::value_ptr(tbn));
-
-	planet.updateRotation();
-	glUniform2f(planetRotRadLoc, planet.rotationRad.x, planet.rotationRad.y);
-
-	// Send noise settings
-	glUniform1f(noiseOffsetLoc, (float)planet.terrain.getSeed());
-	glUniform1i(fbmIterationsLoc, planet.terrain.getDetailLevel());
+	// Baked terrain, rendered procedurally until the first bake is ready
+	updateBakedTerrain();
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, (bakedTerrain && bakedCubemap) ? bakedCubemap : 0);
 
-	// Send current operating mode
-	glUniform1i(performanceModeLoc, (int)performanceMode);
-	glUniform1i(hardShadLoc, (int)hardShadows);
+	// Camera, planet rotation, noise settings, modes and ray bounds, sent if any of them changed
+	uploadFrameUniforms(frameUniforms(w, h));
+	// User created terrain (if any), sent after edits
+	bindTerrainEdits();
 
-	// Send user created terrain (if any)
-	size_t numP = planet.terrain.getAddedTerrainArraySize();
-	glUniform3fv(pArrayLoc, (GLsizei)numP, glm::value_ptr(planet.terrain.getAddedTerrainPointsArray()[0]));
-	glUniform1fv(rArrayLoc, (GLsizei)numP, &planet.terrain.getAddedTerrainRadiusArray()[0]);
-	glUniform1fv(hArrayLoc, (GLsizei)numP, &planet.terrain.getAddedTerrainHeightArray()[0]);
-	glUniform1i(numPointsLoc, (int)numP);
+	// Start distances for the full resolution rays
+	if (depthPrepass) {
+		renderDepthPrepass(w, h);
+	}
 
 	// Use our vertex format and buffers
 	glBindVertexArray(lineVao);
 	// Draw the geometry
 	glLineWidth((GLfloat)10.0f);  // define the width of the bar
+	profiler.beginGpu(FrameProfiler::GPU_TRACE);
 	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, NULL);  // NOTE: use GL_LINE will fail to draw the line
+	profiler.endGpu(FrameProfiler::GPU_TRACE);
 	// Cleanup state
 	glBindVertexArray(0);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glActiveTexture(GL_TEXTURE0);
+	unbindTerrainEdits();
 
 	glUseProgram(0);
 }
 
+GLState::FrameUniforms GLState::frameUniforms(int w, int h) {
+	FrameUniforms u;
+	glm::mat3 tbn = cam.getTBNMatrix();
+	for (int i = 0; i < 3; i++) {
+		u.camTBNMat[i] = glm::vec4(tbn[i], 0.0f);
+		u.planetRotation[i] = glm::vec4(planet.rotation[i], 0.0f);
+	}
+	u.cameraPosition = cam.getCoords();
+	u.noiseOffset = (float)planet.terrain.getSeed();
+	u.iResolution = glm::ivec2(w, h);
+	u.fbmIterations = planet.terrain.getDetailLevel();
+	u.performanceMode = (int)performanceMode;
+	u.hardShadows = (int)hardShadows;
+
+	// Outer radius of the terrain shell, rays only march inside it. Bilinear filtering keeps
+	// the baked field within its texel range, the procedural one needs the analytic bound
+	bool useBaked = bakedTerrain && (bakedCubemap != 0);
+	u.bakedTerrain = (int)useBaked;
+	u.terrainMaxDisplace = useBaked ? bakedMaxHeight : planet.terrain.getDisplacementBounds().y;
+	u.terrainLipschitz = planet.terrain.getLipschitzBound();
+	u.marchMode = marchMode;
+	u.prepassFactor = depthPrepass ? prepassFactor : 0;
+	u.splatEdits = (int)splatEdits;
+	return u;
+}
+
+void GLState::uploadFrameUniforms(const FrameUniforms &uniforms) {
+	// Most redraws only move the camera or the planet, static settings cost nothing
+	if (frameUboValid && (std::memcmp(&uniforms, &uploadedFrame, sizeof(FrameUniforms)) == 0)) {
+		return;
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, frameUbo);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameUniforms), &uniforms);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	uploadedFrame = uniforms;
+	frameUboValid = true;
+}
+
+void GLState::updateEditCubemap() {
+	// The editor only keeps the field while it is used
+	planet.terrain.setEditFieldResolution(splatEdits ? editFieldResolution : 0);
+	EditField &edits = planet.terrain.getEditField();
+	const Heightfield &field = edits.getField();
+	if (field.resolution == 0) {
+		return;
+	}
+
+	if (!editCubemap) {
+		glGenTextures(1, &editCubemap);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, editCubemap);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	}
+	glBindTexture(GL_TEXTURE_CUBE_MAP, editCubemap);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	if (editCubemapResolution != field.resolution) {
+		for (int f = 0; f < 6; f++) {
+			edits.takeChanged(f);
+			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + f, 0, GL_R32F, field.resolution, field.resolution, 0, GL_RED, GL_FLOAT, field.face(f));
+		}
+		editCubemapResolution = field.resolution;
+	}
+	else {
+		// An edit only changed the texels within its radius
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, field.resolution);
+		for (int f = 0; f < 6; f++) {
+			EditField::Rect changed = edits.takeChanged(f);
+			if (!changed.empty()) {
+				glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + f, 0, changed.x0, changed.y0, changed.x1 - changed.x0 + 1, changed.y1 - changed.y0 + 1,
+					GL_RED, GL_FLOAT, field.face(f) + (size_t)changed.y0 * field.resolution + changed.x0);
+			}
+		}
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	}
+	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+}
+
+void GLState::bindTerrainEdits() {
+	unsigned int revision = planet.terrain.getEditRevision();
+	if (!editsValid || (uploadedEditRevision != revision)) {
+		// Adding or undoing a mound only sends the mounds past the first changed one. The packed
+		// records are uploaded as they are stored
+		const std::vector<PackedMound> &mounds = planet.terrain.getMounds();
+		moundBuffer.update(mounds.data(), mounds.size() * sizeof(PackedMound));
+
+		const std::vector<uint32_t> &index = planet.terrain.getMoundIndex().getPacked();
+		moundIndexBuffer.update(index.data(), index.size() * sizeof(uint32_t));
+
+		uploadedEditRevision = revision;
+		editsValid = true;
+	}
+	updateEditCubemap();
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_BUFFER, moundIndexBuffer.getTexture());
+	glActiveTexture(GL_TEXTURE3);
+	glBindTexture(GL_TEXTURE_BUFFER, moundBuffer.getTexture());
+	glActiveTexture(GL_TEXTURE4);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, splatEdits ? editCubemap : 0);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+void GLState::unbindTerrainEdits() {
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glActiveTexture(GL_TEXTURE3);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glActiveTexture(GL_TEXTURE4);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+	glActiveTexture(GL_TEXTURE0);
+}
+
 // Create shaders and associated state
 void GLState::initShaders() {
-	// Compile and link shader files
-	std::vector<GLuint> lineShaders;
-	lineShaders.push_back(compileShader(GL_VERTEX_SHADER, "shaders/v.glsl"));
-	lineShaders.push_back(compileShader(GL_FRAGMENT_SHADER, "shaders/f.glsl"));
-	lineShader = linkProgram(lineShaders);
-	for (auto s : lineShaders)
-		glDeleteShader(s);
-	lineShaders.clear();
-
-	// Get locations of variables on GPU
-	camPosLoc				= glGetUniformLocation(lineShader, "cameraPosition"); 
-	camTBNMatLoc			= glGetUniformLocation(lineShader, "camTBNMat");
-	planetRotRadLoc			= glGetUniformLocation(lineShader, "planetRotationAngleRadians");
-	noiseOffsetLoc			= glGetUniformLocation(lineShader, "noiseOffset"); 
-	fbmIterationsLoc		= glGetUniformLocation(lineShader, "fbmIterations");
-	performanceModeLoc		= glGetUniformLocation(lineShader, "performanceMode");
-	iResolution_uniform_loc = glGetUniformLocation(lineShader, "iResolution");
-	pArrayLoc				= glGetUniformLocation(lineShader, "pArray");
-	rArrayLoc				= glGetUniformLocation(lineShader, "rArray");
-	hArrayLoc				= glGetUniformLocation(lineShader, "hArray");
-	numPointsLoc			= glGetUniformLocation(lineShader, "numUserAddedPoints");
-	hardShadLoc				= glGetUniformLocation(lineShader, "hardShadowsEnable");
-
-	// Initialize user generated terrain array size to 0
-	glUniform1i(numPointsLoc, 0);
+	// Drop every program, they are rebuilt from the (possibly edited) sources
+	for (auto &variant : shaderVariants) {
+		glDeleteProgram(variant.second);
+	}
+	shaderVariants.clear();
+	lineShader = 0;
+
+	// Only the program for the current settings is needed now, precompileShaders() does the rest
+	selectShader();
+
+	// New program, the cached frame is stale
+	frameValid = false;
+}
+
+int GLState::shaderVariantKey(bool performance, bool hard, int detail) {
+	// Hard shadows only exist in performance mode
+	hard = performance && hard;
+	return (detail * 2 + (int)performance) * 2 + (int)hard;
+}
+
+GLuint GLState::buildShader(int key) {
+	std::vector<std::string> defines;
+	if (key != GENERIC_SHADER) {
+		defines.push_back("HARD_SHADOWS " + std::to_string(key & 1));
+		defines.push_back("PERFORMANCE_MODE " + std::to_string((key >> 1) & 1));
+		defines.push_back("FBM_ITERATIONS " + std::to_string(key >> 2));
+	}
+
+	// Reuse a binary from an earlier run, otherwise compile and link shader files and keep the result
+	uint64_t cacheKey = programCache.key({ loadShaderSource("shaders/v.glsl"), loadShaderSource("shaders/f.glsl") }, defines);
+	GLuint program = programCache.load(cacheKey);
+	if (!program) {
+		std::vector<GLuint> lineShaders;
+		lineShaders.push_back(compileShader(GL_VERTEX_SHADER, "shaders/v.glsl", defines));
+		lineShaders.push_back(compileShader(GL_FRAGMENT_SHADER, "shaders/f.glsl", defines));
+		program = linkProgram(lineShaders, programCache.isEnabled());
+		for (auto s : lineShaders)
+			glDeleteShader(s);
+		lineShaders.clear();
+		programCache.save(cacheKey, program);
+	}
+
+	// Per frame state comes from the uniform block, baked terrain is read from texture unit 0
+	glUniformBlockBinding(program, glGetUniformBlockIndex(program, "FrameUniforms"), frameUniformsBinding);
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "terrainCubemap"), 0);
+	glUniform1i(glGetUniformLocation(program, "prepassDepth"), 1);
+	glUniform1i(glGetUniformLocation(program, "moundIndex"), 2);
+	glUniform1i(glGetUniformLocation(program, "moundData"), 3);
+	glUniform1i(glGetUniformLocation(program, "editHeights"), 4);
+	glUseProgram(0);
+
+	shaderVariants[key] = program;
+	return program;
+}
+
+void GLState::selectShader() {
+	auto variant = shaderVariants.find(shaderVariantKey(performanceMode, hardShadows, planet.terrain.getDetailLevel()));
+	if (variant == shaderVariants.end()) {
+		variant = shaderVariants.find(GENERIC_SHADER);
+	}
+	// Nothing usable yet, build the variant now
+	GLuint program = (variant != shaderVariants.end()) ? variant->second
+		: buildShader(shaderVariantKey(performanceMode, hardShadows, planet.terrain.getDetailLevel()));
+	if (program != lineShader) {
+		lineShader = program;
+		getUniformLocations();
+	}
+}
+
+bool GLState::precompileShaders(bool spareTime) {
+	// The current settings first, then the generic fallback, then what 'p', 'h', 'c' and 'z' switch
+	// to from here. Detail is limited to [0, 12] by TerrainEditor
+	int detail = planet.terrain.getDetailLevel();
+	int current = shaderVariantKey(performanceMode, hardShadows, detail);
+	std::vector<int> wanted = { current };
+	if (spareTime) {
+		wanted.push_back(GENERIC_SHADER);
+		for (int d : { detail, detail + 1, detail - 1 }) {
+			if ((d >= 0) && (d <= 12)) {
+				wanted.push_back(shaderVariantKey(true, true, d));
+				wanted.push_back(shaderVariantKey(true, false, d));
+				wanted.push_back(shaderVariantKey(false, false, d));
+			}
+		}
+	}
+
+	// One program per call, each compile can take a while on software GL
+	for (int key : wanted) {
+		if (!shaderVariants.count(key)) {
+			buildShader(key);
+			if (key == current) {
+				frameValid = false; // Redraw with it
+			}
+			return true;
+		}
+	}
+	return false;
+}
+
+void GLState::getUniformLocations() {
+	// Get locations of variables on GPU, everything set per frame is in the uniform blocks
+	terrainReadbackLoc		= glGetUniformLocation(lineShader, "terrainReadback");
+	terrainCubemapLoc		= glGetUniformLocation(lineShader, "terrainCubemap");
+	stepReadbackLoc			= glGetUniformLocation(lineShader, "stepReadback");
+	depthPrepassLoc			= glGetUniformLocation(lineShader, "depthPrepass");
+	prepassDepthLoc			= glGetUniformLocation(lineShader, "prepassDepth");
+}
+
+void GLState::updateBakedTerrain() {
+	if (!bakedTerrain) {
+		return;
+	}
+
+	// Hashing the edits is only needed after the terrain changed
+	unsigned int revision = planet.terrain.getRevision();
+	if (!currentKeyValid || (currentKeyRevision != revision)) {
+		currentKey = { planet.terrain.getSeed(), planet.terrain.getDetailLevel(), planet.terrain.getEditHash(), bakeResolution };
+		currentKeyRevision = revision;
+		currentKeyValid = true;
+	}
+
+	// Finished bakes are cached even if the terrain moved on, flipping back to them is then free
+	Heightfield field;
+	PlanetKey fieldKey;
+	if (baker.poll(field, fieldKey) && !planetCache.find(fieldKey)) {
+		cacheBakedTerrain(fieldKey, field);
+	}
+
+	if (bakedCubemap && (bakedKey == currentKey)) {
+		return;
+	}
+
+	// Memory tier here, the baker thread tries the disk tier before baking. Only the upload of its
+	// result happens on this thread
+	const PlanetCache::Entry *entry = planetCache.find(currentKey);
+	if (entry) {
+		bakedCubemap = entry->cubemap;
+		bakedKey = entry->key;
+		bakedMaxHeight = entry->maxHeight;
+	}
+	else if (!bakeRequested || (requestedKey != currentKey)) {
+		baker.request(planet.terrain, bakeResolution, planetCache.getDiskDirectory());
+		requestedKey = currentKey;
+		bakeRequested = true;
+	}
+}
+
+const PlanetCache::Entry *GLState::cacheBakedTerrain(const PlanetKey &key, const float *heights, float minHeight, float maxHeight) {
+	PlanetCache::Entry entry;
+	entry.key = key;
+	entry.bytes = (size_t)6 * key.resolution * key.resolution * sizeof(float);
+	entry.minHeight = minHeight;
+	entry.maxHeight = maxHeight;
+
+	glGenTextures(1, &entry.cubemap);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, entry.cubemap);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	for (int f = 0; f < 6; f++) {
+		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + f, 0, GL_R32F, key.resolution, key.resolution, 0, GL_RED, GL_FLOAT, heights + (size_t)f * key.resolution * key.resolution);
+	}
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+	// Keep the cubemap on screen alive while evicting
+	planetCache.insert(entry, bakedCubemap ? bakedKey : key);
+	return planetCache.find(key);
+}
+
+void GLState::savePlanet(std::string filename, int bakeLevels) {
+	// Any cached bake of the planet as it is now, read back from its cubemap
+	PlanetKey key = { planet.terrain.getSeed(), planet.terrain.getDetailLevel(), planet.terrain.getEditHash(), bakeResolution };
+	const PlanetCache::Entry *entry = planetCache.find(key);
+	Heightfield bake;
+	if (entry) {
+		bake.resolution = key.resolution;
+		bake.minHeight = entry->minHeight;
+		bake.maxHeight = entry->maxHeight;
+		bake.heights.resize((size_t)6 * key.resolution * key.resolution);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, entry->cubemap);
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		for (int f = 0; f < 6; f++) {
+			glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + f, 0, GL_RED, GL_FLOAT, bake.face(f));
+		}
+		glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+	}
+	PlanetFile::save(filename, planet.terrain, entry ? &bake : nullptr, bakeLevels);
+}
+
+void GLState::loadPlanet(std::string filename) {
+	// Opening validates the whole file, nothing changes if it throws
+	PlanetFile file(filename);
+	planet.terrain.setSeed(file.getSeed());
+	planet.terrain.setDetail(file.getDetail());
+	planet.terrain.setMounds(std::vector<PackedMound>(file.getMounds(), file.getMounds() + file.getMoundCount())); // The editor keeps its own copy
+
+	// Only the level updateBakedTerrain() asks for is worth GPU memory, its heights are uploaded from the mapping
+	for (const PlanetFile::Level &level : file.getLevels()) {
+		PlanetKey key = { file.getSeed(), file.getDetail(), file.getEditHash(), level.resolution };
+		if ((level.resolution == bakeResolution) && !planetCache.find(key)) {
+			cacheBakedTerrain(key, level.heights, level.minHeight, level.maxHeight);
+		}
+	}
 }
 
 void GLState::updateTime(float time) {
@@ -185,7 +674,7 @@ void GLState::onPlanetClicked(glm::vec2 mousePos) {
 		}
 	}
 	if (item < 100.0f) { // if hit, add point
-		glm::vec3 center = ro + item * rd;
+		glm::vec3 center = planet.rotation * (ro + item * rd); // mounds live in planet space, like displace() samples
 		float radius = planet.terrain.clickTCRadius;
 		float height = planet.terrain.clickTCHeight;
 		planet.terrain.addTerrain(center, radius, height);
@@ -198,6 +687,257 @@ void GLState::onPlanetClicked(glm::vec2 mousePos) {
 
 
 
+}
+
+// Number of representable floats between a and b
+static int64_t ulpDistance(float a, float b) {
+	int32_t ia, ib;
+	std::memcpy(&ia, &a, sizeof(float));
+	std::memcpy(&ib, &b, sizeof(float));
+	// Map the sign-magnitude encoding onto a monotonic integer line (+0 and -0 coincide)
+	int64_t la = (ia < 0) ? (int64_t)INT32_MIN - ia : ia;
+	int64_t lb = (ib < 0) ? (int64_t)INT32_MIN - ib : ib;
+	return std::abs(la - lb);
+}
+
+bool GLState::verifyTerrain() {
+	// Largest accepted difference between GPU and CPU displacement. Terrain color bands are 0.005 wide,
+	// so this only allows for GPU rounding in exp/pow, not for a diverging implementation
+	const float tolerance = 1e-4f;
+	const int size = 64; // Grid of sample points, see terrainReadback in f.glsl
+
+	// Float render target for the raw displacement values
+	GLuint tex, fbo;
+	createRenderTarget(size, size, GL_R32F, tex, fbo);
+	glViewport(0, 0, size, size);
+
+	// Draw with the current terrain settings
+	selectShader();
+	glUseProgram(lineShader);
+	FrameUniforms uniforms = frameUniforms(size, size);
+	uniforms.bakedTerrain = 0;
+	uniforms.splatEdits = 0;
+	uploadFrameUniforms(uniforms);
+	bindTerrainEdits();
+	glUniform1i(terrainReadbackLoc, 1);
+
+	glBindVertexArray(lineVao);
+	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, NULL);
+	glBindVertexArray(0);
+	glUniform1i(terrainReadbackLoc, 0);
+	glUseProgram(0);
+	unbindTerrainEdits();
+
+	std::vector<float> gpu(size * size);
+	glReadPixels(0, 0, size, size, GL_RED, GL_FLOAT, gpu.data());
+
+	// Cleanup state
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &fbo);
+	glDeleteTextures(1, &tex);
+	glViewport(0, 0, width, height);
+
+	// Compare against the CPU port at the same points
+	float maxError = 0.0f;
+	std::vector<float> px(size * size), py(size * size), pz(size * size), batch(size * size);
+	for (int y = 0; y < size; y++) {
+		for (int x = 0; x < size; x++) {
+			glm::vec3 p = glm::vec3((float)x / 32.0f - 0.9871f, (float)y / 32.0f - 0.9871f, 0.4137f);
+			float cpu = planet.terrain.displace(p, planet.rotation);
+			maxError = std::max(maxError, std::abs(cpu - gpu[y * size + x]));
+			px[y * size + x] = p.x;
+			py[y * size + x] = p.y;
+			pz[y * size + x] = p.z;
+		}
+	}
+
+	bool passed = maxError <= tolerance;
+	printf("Terrain check %s: max CPU/GPU displacement difference %g (tolerance %g)\n", passed ? "PASSED" : "FAILED", maxError, tolerance);
+
+	// The batched fbm kernel must match the scalar one exactly
+	int detail = planet.terrain.getDetailLevel();
+	float seed = (float)planet.terrain.getSeed();
+	fbmBatch(px.data(), py.data(), pz.data(), batch.data(), batch.size(), detail, seed);
+	int64_t maxUlp = 0;
+	for (size_t i = 0; i < batch.size(); i++) {
+		maxUlp = std::max(maxUlp, ulpDistance(batch[i], fbm(glm::vec3(px[i], py[i], pz[i]), detail, seed)));
+	}
+	bool batchPassed = maxUlp == 0;
+	printf("Noise batch check %s: %s path, max difference from scalar %lld ULP (bound 0)\n", batchPassed ? "PASSED" : "FAILED", noiseBatchPath(), (long long)maxUlp);
+
+	// Analytic gradients (normals) against central differences of displace(). The step shrinks with the
+	// highest octave's wavelength to keep truncation error small at any detail level. The noise kernel
+	// (radius^2 0.6) slightly overlaps neighbouring simplex cells, so the value jumps a little at cell faces
+	// and differences straddling one are meaningless: compare the median instead of the maximum
+	const float step = 0.03f / (float)(1 << detail);
+	float maxValueError = 0.0f;
+	std::vector<float> gradErrors(px.size());
+	for (size_t i = 0; i < px.size(); i++) {
+		glm::vec3 p = glm::vec3(px[i], py[i], pz[i]);
+		glm::vec4 d = planet.terrain.displaceD(p, planet.rotation);
+		glm::vec3 numeric;
+		for (int axis = 0; axis < 3; axis++) {
+			glm::vec3 e = glm::vec3(0.0f);
+			e[axis] = step;
+			numeric[axis] = (planet.terrain.displace(p + e, planet.rotation) - planet.terrain.displace(p - e, planet.rotation)) / (2.0f * step);
+		}
+		maxValueError = std::max(maxValueError, std::abs(d.x - planet.terrain.displace(p, planet.rotation)));
+		gradErrors[i] = glm::length(glm::vec3(d.y, d.z, d.w) - numeric) / std::max(1.0f, glm::length(numeric));
+	}
+	auto median = gradErrors.begin() + gradErrors.size() / 2;
+	std::nth_element(gradErrors.begin(), median, gradErrors.end());
+	const float gradTolerance = 1e-2f;
+	bool gradPassed = (maxValueError == 0.0f) && (*median <= gradTolerance);
+	printf("Terrain gradient check %s: median relative difference from central differences %g (tolerance %g), value difference %g\n", gradPassed ? "PASSED" : "FAILED", *median, gradTolerance, maxValueError);
+
+	// Packed edits: every stored mound and a spiral of directions with a range of sizes must unpack within
+	// the rounding of their encoding, and pack to the same record again (saved files depend on it)
+	const float centerTolerance = 5e-5f; // Chord length, two snorm16 octahedral steps are about 4.3e-5
+	std::vector<PackedMound> records = planet.terrain.getMounds();
+	float maxCenterError = 0.0f, maxValueRatio = 0.0f;
+	const int spiral = 4096;
+	for (int i = 0; i < spiral; i++) {
+		float z = 1.0f - 2.0f * ((float)i + 0.5f) / (float)spiral;
+		float angle = 2.39996323f * (float)i; // Golden angle
+		glm::vec3 center = glm::vec3(std::sqrt(1.0f - z * z) * glm::vec2(std::cos(angle), std::sin(angle)), z);
+		float radius = 0.001f * std::pow(4000.0f, (float)(i % 97) / 96.0f);
+		float height = 0.5f * std::sin(0.37f * (float)i);
+		PackedMound record = packMound(center, radius, height);
+		Mound m = unpackMound(record);
+		// Half floats round to 11 significant bits, subnormals to 2^-24
+		auto ratio = [](float value, float exact) { return std::abs(value - exact) / std::max(std::abs(exact) * 0.00048828125f, 5.96046448e-8f); };
+		maxCenterError = std::max(maxCenterError, glm::length(m.center - center));
+		maxValueRatio = std::max(maxValueRatio, std::max(ratio(m.radius, radius), ratio(m.height, height)));
+		records.push_back(record);
+	}
+	size_t repackMismatches = 0;
+	for (const PackedMound &record : records) {
+		Mound m = unpackMound(record);
+		repackMismatches += (packMound(m.center, m.radius, m.height) != record) ? 1 : 0;
+	}
+	bool packPassed = (maxCenterError <= centerTolerance) && (maxValueRatio <= 1.0f) && (repackMismatches == 0);
+	printf("Edit packing check %s: %zu records, %zu changed after a round trip, max center error %g (tolerance %g), radius/height error %g of half rounding\n",
+		packPassed ? "PASSED" : "FAILED", records.size(), repackMismatches, maxCenterError, centerTolerance, maxValueRatio);
+
+	// Baked terrain is displace() of the unit direction, sampled by the direction of p, while the procedural
+	// path evaluates displace(p) itself. At the surface (|p| = 1 + h) the two differ by up to the terrain
+	// slope times |h|, plus the bilinear error of about the slope times a texel diagonal (2.83 / resolution)
+	const int bakeSize = 64;
+	planet.terrain.generate(bakeSize);
+	const Heightfield &bake = planet.terrain.getHeightfield();
+	float slope = planet.terrain.getLipschitzBound() - 1.0f;
+	float maxBakeError = 0.0f, maxBakeRatio = 0.0f;
+	for (size_t i = 0; i < px.size(); i++) {
+		glm::vec3 dir = glm::normalize(glm::vec3(px[i], py[i], pz[i]));
+		float baked = bake.sample(dir);
+		float error = std::abs(planet.terrain.displace(dir * (1.0f + baked)) - baked);
+		maxBakeError = std::max(maxBakeError, error);
+		maxBakeRatio = std::max(maxBakeRatio, error / (slope * (std::abs(baked) + 2.83f / (float)bakeSize)));
+	}
+	bool bakePassed = maxBakeRatio <= 1.0f;
+	printf("Baked terrain check %s: max baked/procedural surface difference %g (%g of the slope bound, %dx%d bake, range %g to %g)\n",
+		bakePassed ? "PASSED" : "FAILED", maxBakeError, maxBakeRatio, bakeSize, bakeSize, bake.minHeight, bake.maxHeight);
+
+	return passed && batchPassed && gradPassed && packPassed && bakePassed;
+}
+
+void GLState::createRenderTarget(int w, int h, GLenum internalFormat, GLuint &tex, GLuint &fbo) {
+	glGenTextures(1, &tex);
+	glBindTexture(GL_TEXTURE_2D, tex);
+	glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, w, h, 0, GL_RED, GL_FLOAT, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex, 0);
+}
+
+void GLState::renderDepthPrepass(int sceneWidth, int sceneHeight) {
+	int w = (sceneWidth + prepassFactor - 1) / prepassFactor;
+	int h = (sceneHeight + prepassFactor - 1) / prepassFactor;
+
+	// Draw into the prepass target, then return to whatever paintGL was drawing into
+	GLint target;
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &target);
+	if (!prepassFbo || (w != prepassWidth) || (h != prepassHeight)) {
+		if (prepassFbo) {
+			glDeleteFramebuffers(1, &prepassFbo);
+			glDeleteTextures(1, &prepassTex);
+		}
+		createRenderTarget(w, h, GL_RG32F, prepassTex, prepassFbo);
+		prepassWidth = w;
+		prepassHeight = h;
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, prepassFbo);
+	glViewport(0, 0, w, h);
+
+	glUniform1i(depthPrepassLoc, 1);
+	glBindVertexArray(lineVao);
+	profiler.beginGpu(FrameProfiler::GPU_PREPASS);
+	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, NULL);
+	profiler.endGpu(FrameProfiler::GPU_PREPASS);
+	glBindVertexArray(0);
+	glUniform1i(depthPrepassLoc, 0);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, target);
+	glViewport(0, 0, sceneWidth, sceneHeight);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, prepassTex);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+const char *GLState::marchModeName(int mode) {
+	switch (mode) {
+	case MARCH_PLAIN:
+		return "plain";
+	case MARCH_LIPSCHITZ:
+		return "Lipschitz bounded";
+	case MARCH_RELAXED:
+		return "over-relaxed";
+	default:
+		return "unknown";
+	}
+}
+
+float GLState::measureMarchSteps() {
+	// Float render target for the per pixel step counts
+	GLuint tex, fbo;
+	createRenderTarget(width, height, GL_R32F, tex, fbo);
+
+	// Draw the current view, writing step counts instead of color
+	selectShader();
+	glUseProgram(lineShader);
+	glUniform1i(stepReadbackLoc, 1);
+	drawScene(width, height);
+	glUseProgram(lineShader);
+	glUniform1i(stepReadbackLoc, 0);
+	glUseProgram(0);
+
+	std::vector<float> steps(width * height);
+	glReadPixels(0, 0, width, height, GL_RED, GL_FLOAT, steps.data());
+
+	// Prepass steps, spread over the pixels they were done for
+	std::vector<float> prepassSteps;
+	if (depthPrepass) {
+		prepassSteps.resize(prepassWidth * prepassHeight);
+		glBindFramebuffer(GL_FRAMEBUFFER, prepassFbo);
+		glReadPixels(0, 0, prepassWidth, prepassHeight, GL_GREEN, GL_FLOAT, prepassSteps.data());
+	}
+
+	// Cleanup state
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &fbo);
+	glDeleteTextures(1, &tex);
+
+	double total = 0.0;
+	for (float s : steps) {
+		total += s;
+	}
+	for (float s : prepassSteps) {
+		total += s;
+	}
+	return (float)(total / std::max((size_t)1, steps.size()));
 }
 
 void GLState::initLineGeometry() {
@@ -242,6 +982,22 @@ void GLState::initLineGeometry() {
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 }
 
+void GLState::initUniformBuffers() {
+	// Layouts the CPU copies rely on
+	static_assert(offsetof(FrameUniforms, cameraPosition) == 96, "FrameUniforms must match std140");
+	static_assert(offsetof(FrameUniforms, iResolution) == 112, "FrameUniforms must match std140");
+	static_assert(offsetof(FrameUniforms, splatEdits) == 152, "FrameUniforms must match std140");
+
+	// Blocks are sized in multiples of a vec4
+	glGenBuffers(1, &frameUbo);
+	glBindBuffer(GL_UNIFORM_BUFFER, frameUbo);
+	glBufferData(GL_UNIFORM_BUFFER, (sizeof(FrameUniforms) + 15) / 16 * 16, NULL, GL_DYNAMIC_DRAW);
+	glBindBufferBase(GL_UNIFORM_BUFFER, frameUniformsBinding, frameUbo);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	frameUboValid = false;
+	editsValid = false;
+}
+
 
 /*####################
 ####    Helpers   ####
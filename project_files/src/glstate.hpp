@@ -4,10 +4,16 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <map>
 #include <glm/glm.hpp>
 #include "gl_core_3_3.h"
 #include "camera.hpp"
 #include "planet.hpp"
+#include "baker.hpp"
+#include "framescheduler.hpp"
+#include "profiler.hpp"
+#include "programcache.hpp"
+#include "texturebuffer.hpp"
 
 /*####################
 ####     Class    ####
@@ -26,15 +32,24 @@ public:
 
 	// Initialization
 	void initLineGeometry();
-	void initShaders();
+	void initShaders();			// (Re)build the program for the current settings, drops all other variants
+	bool precompileShaders(bool spareTime);	// Build the missing program for the current settings, with spareTime also one a key press may switch to next. False if nothing was left to build
 
 	// Callbacks
 	void initializeGL();
 	void paintGL();
 	void resizeGL(int w, int h);
+	bool needsRedraw(); // Anything changed since the frame paintGL() last drew, idle() redraws only then
+	inline void requestRedraw() { frameValid = false; } // Make the next paintGL() draw the scene even if nothing changed
 
 	void updateTime(float time);
 	void onPlanetClicked(glm::vec2 mousePos);
+	bool verifyTerrain(); // Compare shader displace() against the CPU port in noise.hpp
+	float measureMarchSteps(); // Average sphere tracing steps per pixel (all rays of a pixel) for the current view
+	void updateBakedTerrain(); // Show the current planet from the cache, or queue a background bake for it
+	bool bakedTerrainReady(); // Baked terrain is off, or the bake of the current planet is on screen
+	void savePlanet(std::string filename, int bakeLevels = 1); // PlanetFile with the cached bake of the current planet, if any
+	void loadPlanet(std::string filename); // Seed, detail and edits from a PlanetFile, its bake level of bakeResolution goes into planetCache
 
 	// Camera
 	Camera cam;
@@ -53,35 +68,159 @@ public:
 
 	// time
 	float currentTime;
+	FrameScheduler frameScheduler;	// Paces redraws, its measured frame intervals are readable by anything that adapts to them
+	FrameProfiler profiler;			// Timings and counters of every paintGL() call
 
 	// performance mode
 	bool performanceMode;
 	bool hardShadows;
 
+	// sphere tracing variant, see rayMarch in f.glsl
+	enum MarchMode {
+		MARCH_PLAIN = 0,	// Full SDF steps, fast but can overshoot steep terrain
+		MARCH_LIPSCHITZ,	// SDF divided by TerrainEditor::getLipschitzBound, does not overshoot while its empirical noise slope holds
+		MARCH_RELAXED,		// Lipschitz bounded with over-relaxed steps and fallback
+		MARCH_MODE_COUNT
+	};
+	int marchMode;
+	static const char *marchModeName(int mode);
+
+	// cone march a low resolution pass first and start full resolution rays at its distances
+	bool depthPrepass;
+	int prepassFactor;		// Full resolution pixels per prepass pixel edge
+
+	// draw the scene at a fraction of the window size chosen from measured GPU time, then
+	// upscale it bilinearly. Frames that stop changing are redrawn once at full size
+	bool dynamicResolution;
+	float renderScale;			// Fraction of the window size per axis for the next changed frame
+	float minRenderScale;
+	float gpuFrameBudget;		// Fraction of the scheduler's target frame time the scene may take on the GPU
+
+	// sample displacement from the baked cubemap instead of running fbm per ray step
+	bool bakedTerrain;
+	int bakeResolution;		// Texels per cubemap face edge
+	PlanetCache planetCache;	// Recently baked planets, revisits skip the bake
+
+	// sample the user mounds from a cubemap TerrainEditor splats every edit into, instead of
+	// looping over the mounds of the cell per ray step
+	bool splatEdits;
+	int editFieldResolution;	// Texels per cubemap face edge
+
+	// linked shader variants kept on disk between runs, off until a directory is set
+	ProgramCache programCache;
+
 	// terrain editing mode (maybe implement)
 	bool placementMode;
 
 protected:
 	// OpenGL states of the platform
-	GLuint lineShader;		// GPU shader program
+	GLuint lineShader;		// GPU shader program, the variant for the current settings or the generic one
 	GLuint lineVao;			// Vertex array object
 	GLuint lineVbuf;		// Vertex buffer
 	GLuint lineIbuf;		// Index buffer
 
-	GLuint camPosLoc;
-	GLuint camTBNMatLoc;
-	GLuint planetRotRadLoc;
-	GLuint noiseOffsetLoc;
-	GLuint fbmIterationsLoc;
-	GLuint performanceModeLoc;
-	GLuint pArrayLoc;
-	GLuint rArrayLoc;
-	GLuint hArrayLoc;
-	GLuint numPointsLoc;
-	GLuint hardShadLoc;
-
-	glm::ivec2 iResolution;
-	GLuint iResolution_uniform_loc;
+	GLuint terrainReadbackLoc;
+	GLuint terrainCubemapLoc;
+	GLuint stepReadbackLoc;
+	GLuint depthPrepassLoc;
+	GLuint prepassDepthLoc;
+
+	// CPU copy of the FrameUniforms block in f.glsl, std140 layout (mat3 columns padded to vec4)
+	struct FrameUniforms {
+		glm::vec4 camTBNMat[3];
+		glm::vec4 planetRotation[3];
+		glm::vec3 cameraPosition;
+		float noiseOffset;
+		glm::ivec2 iResolution;
+		int fbmIterations;
+		int performanceMode;
+		int hardShadows;
+		int bakedTerrain;
+		float terrainMaxDisplace;
+		float terrainLipschitz;
+		int marchMode;
+		int prepassFactor;
+		int splatEdits;
+	};
+	// Frame uniform block and the edit texture buffers, each uploaded only when its contents
+	// change. Edits are not limited in number, the buffers grow with them
+	GLuint frameUbo;
+	FrameUniforms uploadedFrame;	// Contents of frameUbo
+	bool frameUboValid;
+	TextureBuffer moundBuffer;		// TerrainEditor::getMounds(), one PackedMound texel per edit
+	TextureBuffer moundIndexBuffer;	// MoundIndex::getPacked()
+	unsigned int uploadedEditRevision;	// TerrainEditor edit revision in the two buffers
+	bool editsValid;
+	GLuint editCubemap;			// TerrainEditor::getEditField(), only the changed texels are uploaded
+	int editCubemapResolution;
+	void initUniformBuffers();
+	FrameUniforms frameUniforms(int w, int h);	// Values a w x h draw of the current scene uses
+	void uploadFrameUniforms(const FrameUniforms &uniforms);
+	void updateEditCubemap();
+	void bindTerrainEdits();	// Upload the edits if they changed, bind both buffers and the edit cubemap
+	void unbindTerrainEdits();
+
+	// Shader variants. performanceMode, hardShadows and the detail level are compile time constants
+	// in f.glsl, toggling them switches programs. The generic program reads them from uniforms and
+	// is drawn with while a variant is still missing
+	static constexpr int GENERIC_SHADER = -1;
+	std::map<int, GLuint> shaderVariants;	// Built programs by shaderVariantKey()
+	int shaderVariantKey(bool performance, bool hard, int detail);
+	GLuint buildShader(int key);
+	void selectShader();		// Make lineShader the best built program for the current settings
+	void getUniformLocations();
+
+	// Depth prepass target, (start distance, march steps) per block, resized with the window
+	GLuint prepassFbo;
+	GLuint prepassTex;
+	int prepassWidth, prepassHeight;
+	void renderDepthPrepass(int w, int h);	// For a w x h scene draw
+
+	// Last drawn frame, blitted to the window while nothing changes
+	struct FrameState {
+		unsigned int camRevision, planetRevision, terrainRevision;
+		GLuint bakedCubemap;
+		bool bakedTerrain, splatEdits, performanceMode, hardShadows;
+		int marchMode;
+		bool depthPrepass;
+		int prepassFactor;
+		int width, height;
+		bool operator==(const FrameState &o) const;
+	};
+	GLuint frameFbo;
+	GLuint frameTex;			// Window sized, scaled frames use its lower left corner
+	int frameWidth, frameHeight;
+	bool frameValid;			// False until the first draw and after a shader reload
+	FrameState drawnFrame;		// Inputs frameTex was drawn with
+	int drawnWidth, drawnHeight;	// Part of frameTex holding the drawn frame
+	FrameScheduler::Clock::time_point lastChangedFrame;	// When the scene last changed, for the full size refresh
+	FrameState frameState();	// Inputs the next draw would use
+	bool sceneChanged();		// frameState() differs from drawnFrame, or the planet is moving
+	void drawScene(int w, int h);	// Draw a w x h frame into the bound framebuffer
+
+	// Dynamic resolution, fed with the GPU times of changed frames from the profiler. Scale changes
+	// only after several measurements and only when the GPU time leaves the band around the
+	// budget, so the scale does not oscillate
+	std::vector<double> scaleSamples;	// Full size cost estimates since the last decision
+	void updateRenderScale(double gpuMs, float scale);
+
+	// Texture (GL_R32F, GL_RG32F, GL_RGBA8, ...) with a framebuffer rendering into it, left bound
+	static void createRenderTarget(int w, int h, GLenum internalFormat, GLuint &tex, GLuint &fbo);
+
+	// Baked displacement. Each bake gets its own cubemap in planetCache, so the one on screen
+	// keeps rendering while the next is baked and swapping is a rebind
+	TerrainBaker baker;
+	GLuint bakedCubemap;			// Cubemap being rendered, 0 before the first bake
+	PlanetKey bakedKey;				// Planet in bakedCubemap
+	float bakedMaxHeight;			// Highest displacement in bakedCubemap
+	PlanetKey currentKey;			// Planet the terrain editor describes now
+	unsigned int currentKeyRevision;	// TerrainEditor revision currentKey was computed at
+	bool currentKeyValid;
+	PlanetKey requestedKey;			// Planet last sent to the baker
+	bool bakeRequested;
+
+	const PlanetCache::Entry *cacheBakedTerrain(const PlanetKey &key, const float *heights, float minHeight, float maxHeight); // Upload six faces of key.resolution^2 into a new cubemap
+	inline const PlanetCache::Entry *cacheBakedTerrain(const PlanetKey &key, const Heightfield &field) { return cacheBakedTerrain(key, field.heights.data(), field.minHeight, field.maxHeight); }
 };
 
 #endif
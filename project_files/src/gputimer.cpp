@@ -0,0 +1,48 @@
+#include "gputimer.hpp"
+
+GpuTimer::GpuTimer(size_t ringSize) : _ringSize(ringSize) {
+}
+
+GpuTimer::~GpuTimer() {
+	if (!_queries.empty()) {
+		glDeleteQueries((GLsizei)_queries.size(), _queries.data());
+	}
+}
+
+bool GpuTimer::begin() {
+	if (_queries.empty()) {
+		_queries.resize(_ringSize);
+		glGenQueries((GLsizei)_ringSize, _queries.data());
+	}
+	if (_pending == _ringSize) {
+		return false;
+	}
+	glBeginQuery(GL_TIME_ELAPSED, _queries[(_first + _pending) % _ringSize]);
+	_active = true;
+	return true;
+}
+
+void GpuTimer::end() {
+	if (_active) {
+		glEndQuery(GL_TIME_ELAPSED);
+		_pending++;
+		_active = false;
+	}
+}
+
+bool GpuTimer::poll(double &ms) {
+	if (_pending == 0) {
+		return false;
+	}
+	GLuint available = 0;
+	glGetQueryObjectuiv(_queries[_first], GL_QUERY_RESULT_AVAILABLE, &available);
+	if (!available) {
+		return false;
+	}
+	GLuint64 ns = 0;
+	glGetQueryObjectui64v(_queries[_first], GL_QUERY_RESULT, &ns);
+	ms = (double)ns / 1.0e6;
+	_first = (_first + 1) % _ringSize;
+	_pending--;
+	return true;
+}
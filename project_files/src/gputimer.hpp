@@ -0,0 +1,29 @@
+#pragma once
+
+#include "gl_core_3_3.h"
+#include <vector>
+
+// Ring of GL_TIME_ELAPSED queries. Results are read only once the GPU reports them available,
+// a few frames later, so timing never stalls the pipeline. When every query in the ring is still
+// pending, begin() drops that measurement instead of waiting.
+class GpuTimer
+{
+public:
+	GpuTimer(size_t ringSize = 4);
+	~GpuTimer();
+	// Disallow copy, move, & assignment
+	GpuTimer(const GpuTimer& other) = delete;
+	GpuTimer& operator=(const GpuTimer& other) = delete;
+
+	bool begin();				// Start timing GL commands, false if the ring is full (end() then does nothing)
+	void end();
+	bool poll(double &ms);		// Oldest finished measurement in milliseconds, false if none is ready
+	inline size_t getPending() { return _pending; }
+
+private:
+	std::vector<GLuint> _queries;	// Created on first use, needs a current context
+	size_t _ringSize;
+	size_t _first = 0;				// Oldest pending query
+	size_t _pending = 0;
+	bool _active = false;
+};
@@ -3,6 +3,7 @@
 #include <filesystem>
 #include <algorithm>
 #include "glstate.hpp"
+#include "bench.hpp"
 #include <GL/freeglut.h>
 
 
@@ -13,6 +14,14 @@
 // OpenGL state
 std::unique_ptr<GLState>	glState;
 float timeWhenMouseClicked;
+std::string planetFile;				// PlanetFile opened once OpenGL is up, if set
+
+// Instrumentation
+bool printProfileSummary = false;	// Rolling summary on stdout, toggled with 'i'
+double lastProfileSummary = 0.0;	// Scheduler time of the last summary
+std::string profileCsvFile;			// Frame history written here on exit, if set
+std::string profileJsonFile;
+std::string benchCsvFile;			// Per segment benchmark results, if set
 
 /*####################
 ####  Prototypes  ####
@@ -20,6 +29,9 @@ float timeWhenMouseClicked;
 
 // Initialization functions
 void	initGLUT(int* argc, char** argv);
+void	applyOptions(int argc, char** argv);
+int		bench(int argc, char** argv, std::string scriptFile);
+void	loadPlanet(std::string filename);
 
 // Callback functions
 void	display();
@@ -37,12 +49,33 @@ void	cleanup();
 
 // Program entry point
 int main(int argc, char** argv) {
+	// Headless benchmarks, no window or GLUT
+	for (int i = 1; i + 1 < argc; i++) {
+		if (std::string(argv[i]) == "--bench") {
+			return bench(argc, argv, argv[i + 1]);
+		}
+		if (std::string(argv[i]) == "--bench-load") {
+			try {
+				runLoadBenchmark(std::stoull(argv[i + 1]));
+			} catch (const std::exception& e) {
+				std::cerr << "Benchmark failed: " << e.what() << std::endl;
+				return -1;
+			}
+			return 0;
+		}
+	}
+
 	try {
 		// Create the window
 		initGLUT(&argc, argv);
 		// Initialize OpenGL (buffers, shaders, etc.)
 		glState = std::unique_ptr<GLState>(new GLState());
+		// Command line options (GLUT already removed its own), before the first shader build
+		applyOptions(argc, argv);
 		glState->initializeGL();
+		if (!planetFile.empty()) {
+			loadPlanet(planetFile);
+		}
 
 	} catch (const std::exception& e) {
 		// Handle any errors
@@ -66,7 +99,8 @@ int main(int argc, char** argv) {
 	std::cout << "			Edits here do not save automatically\n" << std::endl;
 	std::cout << "			- Tap the LEFT MOUSE BUTTON to generate terrain at the mouse cursor's location on the planet \n" << std::endl;
 	std::cout << "			- Tap 'CTRL' + 'z' to remove last edit (including those loaded from the config file) \n" << std::endl;
-	std::cout << "			- Tap 'CTRL' + 's' to save all changes to config file \n" << std::endl;
+	std::cout << "			- Tap 'CTRL' + 's' to save all changes to config file, and the planet with its bake (if any) to config.planet \n" << std::endl;
+	std::cout << "			- Tap 'CTRL' + 'r' to load seed, detail, edits and bake from config.planet \n" << std::endl;
 	std::cout << "			Control the radius: \n" << std::endl;
 	std::cout << "				- Tap 'c' to increment the radius by 0.05\n" << std::endl;
 	std::cout << "				- Tap 'z' to decrement the radius by 0.05\n" << std::endl;
@@ -74,6 +108,13 @@ int main(int argc, char** argv) {
 	std::cout << "				- Tap 'e' to increment the height by 0.05\n" << std::endl;
 	std::cout << "				- Tap 'q' to decrement the height by 0.05\n" << std::endl;
 	std::cout << "		- Tap 'r' to load/reload the terrain edits saved in the config file\n" << std::endl;
+	std::cout << "		- Tap 'v' to verify the CPU terrain port against the shader\n" << std::endl;
+	std::cout << "		- Tap 'b' to toggle baked terrain, samples a precomputed cubemap instead of running FBM per pixel\n" << std::endl;
+	std::cout << "		- Tap 'g' to toggle splatted edits, samples the terrain edits from a cubemap instead of looping over them per pixel\n" << std::endl;
+	std::cout << "		- Tap 'd' to toggle the low resolution depth prepass that seeds ray start distances\n" << std::endl;
+	std::cout << "		- Tap 'm' to cycle the sphere tracing mode (plain, Lipschitz bounded, over-relaxed) and print average steps per pixel\n" << std::endl;
+	std::cout << "		- Tap 'u' to toggle dynamic resolution, draws moving frames smaller to hold the target frame rate\n" << std::endl;
+	std::cout << "		- Tap 'i' to toggle a per second summary of CPU and GPU frame timings\n" << std::endl;
 	std::cout << "		- Tap ESC to exit the application\n" << std::endl;
 	std::cout << "		Control amount of detail:\n" << std::endl;
 	std::cout << "			- Tap 'c' to increment the fractal brownian motion (FBM) iterations\n" << std::endl;
@@ -94,6 +135,73 @@ int main(int argc, char** argv) {
 ####     Init     ####
 ####################*/
 
+// Settings from the command line that apply to the GLState
+void applyOptions(int argc, char** argv) {
+	std::string shaderCache = "shader_cache";
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if ((arg == "--shader-cache") && (i + 1 < argc)) {
+			shaderCache = argv[++i];
+		}
+		else if (arg == "--no-shader-cache") {
+			shaderCache = "";
+		}
+		else if ((arg == "--bake-cache") && (i + 1 < argc)) {
+			glState->planetCache.setDiskDirectory(argv[++i]);
+		}
+		else if ((arg == "--bake-cache-mb") && (i + 1 < argc)) {
+			glState->planetCache.setBudget(std::stoull(argv[++i]) * 1024 * 1024);
+		}
+		else if ((arg == "--target-fps") && (i + 1 < argc)) {
+			glState->frameScheduler.setTargetFps(std::stod(argv[++i]));
+		}
+		else if ((arg == "--profile-csv") && (i + 1 < argc)) {
+			profileCsvFile = argv[++i];
+		}
+		else if ((arg == "--profile-json") && (i + 1 < argc)) {
+			profileJsonFile = argv[++i];
+		}
+		else if ((arg == "--bench-csv") && (i + 1 < argc)) {
+			benchCsvFile = argv[++i];
+		}
+		else if ((arg == "--planet") && (i + 1 < argc)) {
+			planetFile = argv[++i];
+		}
+	}
+	glState->programCache.setDirectory(shaderCache);
+}
+
+// Open a PlanetFile, a missing or invalid file is reported and the current planet kept
+void loadPlanet(std::string filename) {
+	try {
+		glState->loadPlanet(filename);
+		printf("Loaded planet from %s \n", filename.c_str());
+	} catch (const std::exception& e) {
+		std::cerr << "Planet not loaded: " << e.what() << std::endl;
+	}
+}
+
+// Render the scripted path offscreen and print frame time percentiles
+int bench(int argc, char** argv, std::string scriptFile) {
+	try {
+		BenchScript script = loadBenchScript(scriptFile);
+		createHeadlessContext();
+		glState = std::unique_ptr<GLState>(new GLState());
+		applyOptions(argc, argv);
+		glState->initializeGL();
+		if (!planetFile.empty()) {
+			glState->loadPlanet(planetFile);
+		}
+		runBenchmark(*glState, script, benchCsvFile);
+	} catch (const std::exception& e) {
+		std::cerr << "Benchmark failed: " << e.what() << std::endl;
+		cleanup();
+		return -1;
+	}
+	cleanup();
+	return 0;
+}
+
 // Setup window and callbacks
 void initGLUT(int* argc, char** argv) {
 	// Set window and context settings
@@ -126,7 +234,13 @@ void display() {
 	glState->paintGL();
 
 	// Scene is rendered to the back buffer, so swap the buffers to display it
-	glutSwapBuffers();
+	{
+		FrameProfiler::ScopedTimer swapTimer(glState->profiler, FrameProfiler::CPU_SWAP);
+		glState->frameScheduler.beginSwap();
+		glutSwapBuffers();
+		glState->frameScheduler.endSwap();
+	}
+	glState->profiler.endFrame();
 }
 
 // Called when the window is resized
@@ -169,46 +283,70 @@ void mouseBtn(int button, int state, int x, int y) {
 	// Scroll wheel up
 	if (button == 3) {
 		glState->cam.zoom(-0.05f);
-		glutPostRedisplay();
 	}
 	// Scroll wheel down
 	if (button == 4) {
 		glState->cam.zoom(0.05f);
-		glutPostRedisplay();
 	}
 }
 
-// Called when the mouse moves
+// Called when the mouse moves. idle() draws the change at the next frame
 void mouseMove(int x, int y) {
 	if (glState->cam.isRotating) {
 		// Rotate the camera if currently rotating
 		glState->cam.rotate(glm::vec2(x, y));
-		glutPostRedisplay();
 
 	}
 	else if (glState->planet.isRotating) {
 		glState->planet.rotate(glm::vec2(x, y));
-		glutPostRedisplay();
 	}
 }
 
-static auto start = std::chrono::time_point_cast<std::chrono::milliseconds>(std::chrono::system_clock::now());	// record start time
-
 // Called when there are no events to process
 void idle() {
 	// NOTE: anything that happens every frame (e.g. movement) should be done here
 	// Be sure to call glutPostRedisplay() if the screen needs to update as well
-	auto	finish	= std::chrono::time_point_cast<std::chrono::milliseconds>(std::chrono::system_clock::now());	// record end time
-	auto	elapsed = static_cast<float>((finish - start).count());
+	FrameScheduler &scheduler = glState->frameScheduler;
 
-	if ((int)elapsed % (int)(1000.0/60.0) == 0) {
-		glState->updateTime(elapsed);
-		glutPostRedisplay();
+	// Sleep until the next frame is due instead of spinning, input that arrives meanwhile is
+	// picked up by that frame
+	scheduler.waitForFrame();
+
+	if (printProfileSummary && (scheduler.getElapsed() - lastProfileSummary > 1000.0)) {
+		lastProfileSummary = scheduler.getElapsed();
+		std::cout << glState->profiler.summary() << std::endl;
+	}
+
+	// Build the program for the current settings if drawing fell back to the generic one, and with
+	// time to spare the ones the next key press may switch to
+	glState->precompileShaders(!glState->needsRedraw());
+
+	// Nothing moved or changed, the window already shows the right frame
+	if (!glState->needsRedraw()) {
+		scheduler.pause();
+		return;
 	}
+
+	glState->updateTime((float)scheduler.getElapsed());
+	glutPostRedisplay();
 }
 
 // Called when the window is closed or the event loop is otherwise exited
 void cleanup() {
+	// Export the frame history before it goes away with the GLState
+	if (glState) {
+		try {
+			if (!profileCsvFile.empty()) {
+				glState->profiler.writeCsv(profileCsvFile);
+			}
+			if (!profileJsonFile.empty()) {
+				glState->profiler.writeJson(profileJsonFile);
+			}
+		} catch (const std::exception& e) {
+			std::cerr << "Profile export failed: " << e.what() << std::endl;
+		}
+	}
+
 	// Delete the GLState object, calling its destructor,
 	// which releases the OpenGL objects
 	glState.reset(nullptr);
@@ -232,6 +370,17 @@ void keyRelease(unsigned char key, int x, int y) {
 			if ((glState->placementMode) && (keyModifier == GLUT_ACTIVE_CTRL)) {
 				glState->planet.terrain.save("config.txt");
 				printf("Saved edits to config.txt \n");
+				try {
+					glState->savePlanet("config.planet");
+					printf("Saved planet to config.planet \n");
+				} catch (const std::exception& e) {
+					std::cerr << "Planet not saved: " << e.what() << std::endl;
+				}
+			}
+			break;
+		case 18:  // 18 for ctrl+r
+			if ((glState->placementMode) && (keyModifier == GLUT_ACTIVE_CTRL)) {
+				loadPlanet("config.planet");
 			}
 			break;
 		case 'H':
@@ -246,8 +395,46 @@ void keyRelease(unsigned char key, int x, int y) {
 			break;
 		case 'R':
 		case 'r':
-			glState->planet.terrain.load("config.txt");
-			printf("Parsed and loaded user config. \n");
+			try {
+				glState->planet.terrain.load("config.txt");
+				printf("Parsed and loaded user config. \n");
+			} catch (const std::exception& e) {
+				std::cerr << "Config not loaded: " << e.what() << std::endl;
+			}
+			break;
+		case 'B':
+		case 'b':
+			glState->bakedTerrain = !glState->bakedTerrain;
+			printf("Baked terrain turned %s. \n", glState->bakedTerrain ? "ON" : "OFF");
+			break;
+		case 'G':
+		case 'g':
+			glState->splatEdits = !glState->splatEdits;
+			printf("Splatted edits turned %s. \n", glState->splatEdits ? "ON" : "OFF");
+			break;
+		case 'V':
+		case 'v':
+			glState->verifyTerrain();
+			break;
+		case 'D':
+		case 'd':
+			glState->depthPrepass = !glState->depthPrepass;
+			printf("Depth prepass turned %s. Average steps per pixel: %0.2f \n", glState->depthPrepass ? "ON" : "OFF", glState->measureMarchSteps());
+			break;
+		case 'M':
+		case 'm':
+			glState->marchMode = (glState->marchMode + 1) % GLState::MARCH_MODE_COUNT;
+			printf("Sphere tracing mode: %s. Average steps per pixel: %0.2f \n", GLState::marchModeName(glState->marchMode), glState->measureMarchSteps());
+			break;
+		case 'U':
+		case 'u':
+			glState->dynamicResolution = !glState->dynamicResolution;
+			printf("Dynamic resolution turned %s. Render scale: %0.3f \n", glState->dynamicResolution ? "ON" : "OFF", glState->dynamicResolution ? glState->renderScale : 1.0f);
+			break;
+		case 'I':
+		case 'i':
+			printProfileSummary = !printProfileSummary;
+			printf("Frame profile summary turned %s. \n", printProfileSummary ? "ON" : "OFF");
 			break;
 		case 'F':
 		case 'f':
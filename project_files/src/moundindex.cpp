@@ -0,0 +1,155 @@
+#include "moundindex.hpp"
+#include <algorithm>
+#include <cmath>
+
+// Cone of directions a cell covers
+struct CellCone {
+	glm::vec3 direction;
+	float angle;
+};
+
+// Direction through face coordinates (s, t) in [-1, 1]. Faces are +X, -X, +Y, -Y, +Z, -Z with
+// s and t along the next two axes, as in cellOf()
+static glm::vec3 faceDirection(int face, float s, float t) {
+	int axis = face / 2;
+	glm::vec3 d;
+	d[axis] = (face & 1) ? -1.0f : 1.0f;
+	d[(axis + 1) % 3] = s;
+	d[(axis + 2) % 3] = t;
+	return glm::normalize(d);
+}
+
+static const std::vector<CellCone> &cellCones() {
+	static const std::vector<CellCone> cones = []() {
+		// A cell's edges are great circles, so its farthest point from the center is a corner
+		std::vector<CellCone> c(MoundIndex::numCells);
+		const int n = MoundIndex::cellsPerEdge;
+		for (int face = 0; face < 6; face++) {
+			for (int y = 0; y < n; y++) {
+				for (int x = 0; x < n; x++) {
+					CellCone &cone = c[(face * n + y) * n + x];
+					cone.direction = faceDirection(face, 2.0f * (x + 0.5f) / n - 1.0f, 2.0f * (y + 0.5f) / n - 1.0f);
+					cone.angle = 0.0f;
+					for (int corner = 0; corner < 4; corner++) {
+						glm::vec3 d = faceDirection(face, 2.0f * (x + (corner & 1)) / n - 1.0f, 2.0f * (y + (corner >> 1)) / n - 1.0f);
+						cone.angle = std::max(cone.angle, std::acos(glm::clamp(glm::dot(d, cone.direction), -1.0f, 1.0f)));
+					}
+				}
+			}
+		}
+		return c;
+	}();
+	return cones;
+}
+
+int MoundIndex::cellOf(glm::vec3 p) {
+	glm::vec3 a = glm::abs(p);
+	int axis = ((a.x >= a.y) && (a.x >= a.z)) ? 0 : ((a.y >= a.z) ? 1 : 2);
+	float major = std::max(a[axis], 1e-30f);
+	float s = p[(axis + 1) % 3] / major;
+	float t = p[(axis + 2) % 3] / major;
+	int face = axis * 2 + ((p[axis] < 0.0f) ? 1 : 0);
+	int x = glm::clamp((int)((s * 0.5f + 0.5f) * (float)cellsPerEdge), 0, cellsPerEdge - 1);
+	int y = glm::clamp((int)((t * 0.5f + 0.5f) * (float)cellsPerEdge), 0, cellsPerEdge - 1);
+	return (face * cellsPerEdge + y) * cellsPerEdge + x;
+}
+
+void MoundIndex::clear() {
+	for (auto &cell : _cells) {
+		cell.clear();
+	}
+	_count = 0;
+	_packedValid = false;
+}
+
+void MoundIndex::add(glm::vec3 center, float radius) {
+	const float margin = 1e-3f; // Radians, covers rounding in the shader's cell lookup near cell edges
+	const float pi = 3.14159265f;
+	const int n = cellsPerEdge;
+	uint32_t index = _count++;
+	_packedValid = false;
+
+	// Points within radius of the center are seen from the planet center inside a cone, or in every
+	// direction once the mound contains the planet center
+	float dist = glm::length(center);
+	if (dist <= radius) {
+		for (auto &cell : _cells) {
+			cell.push_back(index);
+		}
+		return;
+	}
+	glm::vec3 dir = center / dist;
+	float angle = std::asin(radius / dist);
+
+	const std::vector<CellCone> &cones = cellCones();
+	for (int face = 0; face < 6; face++) {
+		// Face directions are at most atan(sqrt(2)) from the face axis
+		int axis = face / 2;
+		float axisAngle = std::acos(glm::clamp((face & 1) ? -dir[axis] : dir[axis], -1.0f, 1.0f));
+		if (axisAngle - angle - margin > 0.9553166f) {
+			continue;
+		}
+
+		// Range of cells to test. Over the cone the axis coordinate is at least m, so s = d[u] / d[axis]
+		// is bounded by the range of d[u] divided by m or 1. A cone reaching the face horizon takes all
+		int x0 = 0, x1 = n - 1, y0 = 0, y1 = n - 1;
+		float farthest = axisAngle + angle + margin;
+		if (farthest < 0.5f * pi - 0.01f) {
+			float m = std::cos(farthest);
+			auto cellRange = [&](int k, int &lo, int &hi) {
+				float phi = std::acos(glm::clamp(dir[k], -1.0f, 1.0f));
+				float low = std::cos(std::min(phi + angle + margin, pi));
+				float high = std::cos(std::max(phi - angle - margin, 0.0f));
+				float sMin = (low < 0.0f) ? low / m : low;
+				float sMax = (high > 0.0f) ? high / m : high;
+				lo = glm::clamp((int)std::floor((sMin * 0.5f + 0.5f) * n), 0, n - 1);
+				hi = glm::clamp((int)std::floor((sMax * 0.5f + 0.5f) * n), 0, n - 1);
+			};
+			cellRange((axis + 1) % 3, x0, x1);
+			cellRange((axis + 2) % 3, y0, y1);
+		}
+
+		// Cells whose cone overlaps the mound's
+		for (int y = y0; y <= y1; y++) {
+			for (int x = x0; x <= x1; x++) {
+				int cell = (face * n + y) * n + x;
+				const CellCone &cone = cones[cell];
+				if (std::acos(glm::clamp(glm::dot(dir, cone.direction), -1.0f, 1.0f)) <= cone.angle + angle + margin) {
+					_cells[cell].push_back(index);
+				}
+			}
+		}
+	}
+}
+
+void MoundIndex::removeLast() {
+	if (_count == 0) {
+		return;
+	}
+	// The last mound is at the back of every list holding it
+	uint32_t index = --_count;
+	for (auto &cell : _cells) {
+		if (!cell.empty() && (cell.back() == index)) {
+			cell.pop_back();
+		}
+	}
+	_packedValid = false;
+}
+
+void MoundIndex::pack() {
+	if (_packedValid) {
+		return;
+	}
+	uint32_t offset = numCells + 1;
+	_packed.resize(numCells + 1);
+	for (int cell = 0; cell < numCells; cell++) {
+		_packed[cell] = offset;
+		offset += (uint32_t)_cells[cell].size();
+	}
+	_packed[numCells] = offset;
+	_packed.resize(offset);
+	for (int cell = 0; cell < numCells; cell++) {
+		std::copy(_cells[cell].begin(), _cells[cell].end(), _packed.begin() + _packed[cell]);
+	}
+	_packedValid = true;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Cube-face grid over directions from the planet center, listing for each cell the user mounds
+// that can reach any point whose direction falls in it (at any distance from the center). A
+// displace() sample then only visits the mounds of its own cell instead of every edit. Lists are
+// conservative and in edit order, so the sum matches looping over all mounds exactly
+class MoundIndex
+{
+public:
+	static const int cellsPerEdge = 16;
+	static const int numCells = 6 * cellsPerEdge * cellsPerEdge;
+
+	static int cellOf(glm::vec3 p); // Cell of the direction of p, moundCell() in f.glsl
+
+	void clear();
+	void add(glm::vec3 center, float radius); // Next mound, indices follow the order of add()
+	void removeLast();
+	inline size_t size() const { return _count; }
+
+	// Packed form read by the shader and the CPU loops: numCells + 1 offsets into the same array
+	// (cell i lists entries offsets[i] to offsets[i + 1]), followed by the mound indices
+	void pack();	// Only rebuilds after changes, call before reading from several threads
+	inline const std::vector<uint32_t> &getPacked() const { return _packed; }
+	inline const uint32_t *cellBegin(int cell) const { return _packed.data() + _packed[cell]; }
+	inline const uint32_t *cellEnd(int cell) const { return _packed.data() + _packed[cell + 1]; }
+
+private:
+	std::vector<std::vector<uint32_t>> _cells = std::vector<std::vector<uint32_t>>(numCells);
+	uint32_t _count = 0;
+	std::vector<uint32_t> _packed = std::vector<uint32_t>(numCells + 1, numCells + 1);
+	bool _packedValid = true;
+};
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <glm/glm.hpp>
+
+// CPU port of the terrain functions in shaders/f.glsl. Each function keeps the shader's
+// single precision operation order, so results only differ by GPU rounding (see GLState::verifyTerrain)
+
+glm::vec3 customMod(glm::vec3 inc);
+glm::vec4 customMod(glm::vec4 inc);
+glm::vec4 permute(glm::vec4 x);
+glm::vec4 inverseSqrtT(glm::vec4 p);
+
+float getNoiseAt(glm::vec3 samplePoint, float noiseOffset); // Simplex noise, noiseOffset is the world seed
+float fbm(glm::vec3 samplePoint, int iterations, float noiseOffset); // Fractal brownian motion over getNoiseAt
+float fbmBound(int iterations); // Empirical bound on |fbm()| for any point and seed (measured maximum with headroom, not proven), for ray bounding shells
+float fbmGradientBound(int iterations); // Empirical bound on |gradient of fbm()| (measured maximum with headroom, not proven), used as its Lipschitz constant
+glm::mat3 rotateYXMatrix(glm::vec2 angle); // Planet rotation (Y then X), angle is PlanetSphere::rotationRad
+float moundHeight(glm::vec3 p, glm::vec3 center, float radius, float height); // Gaussian user mound, 0 outside radius
+
+// Analytic gradient variants: value in x (same as the plain function), gradient with respect to samplePoint/p in yzw
+glm::vec4 getNoiseAtD(glm::vec3 samplePoint, float noiseOffset);
+glm::vec4 fbmD(glm::vec3 samplePoint, int iterations, float noiseOffset);
+glm::vec4 moundHeightD(glm::vec3 p, glm::vec3 center, float radius, float height);
+
+// Batched fbm/getNoiseAt over structure-of-arrays input: x, y, z and out hold count floats each.
+// An AVX2 (8 wide), SSE4.1 (4 wide) or scalar path is picked once at runtime. The vector paths run
+// the same IEEE operations in the same order as the scalar functions and never fuse multiply-adds,
+// so results are within 0 ULP of fbm()/getNoiseAt() (checked by GLState::verifyTerrain)
+void fbmBatch(const float *x, const float *y, const float *z, float *out, size_t count, int iterations, float noiseOffset);
+void getNoiseAtBatch(const float *x, const float *y, const float *z, float *out, size_t count, float noiseOffset);
+const char *noiseBatchPath(); // Name of the selected path: "AVX2", "SSE4.1" or "scalar"
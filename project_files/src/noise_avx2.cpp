@@ -0,0 +1,41 @@
+// AVX2 build of the batched noise kernel, compiled with -mavx2 (see Makefile).
+// Only include intrinsics here: inline code from other headers compiled with these flags
+// could be picked by the linker for the whole program.
+#include <cstddef>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+
+namespace {
+
+struct V {
+	static const size_t width = 8;
+	__m256 v;
+
+	V() {}
+	V(__m256 x) : v(x) {}
+	V(float x) : v(_mm256_set1_ps(x)) {}
+	static V load(const float *p) { return _mm256_loadu_ps(p); }
+	static void store(float *p, V x) { _mm256_storeu_ps(p, x.v); }
+};
+
+inline V operator+(V a, V b) { return _mm256_add_ps(a.v, b.v); }
+inline V operator-(V a, V b) { return _mm256_sub_ps(a.v, b.v); }
+inline V operator*(V a, V b) { return _mm256_mul_ps(a.v, b.v); }
+inline V operator/(V a, V b) { return _mm256_div_ps(a.v, b.v); }
+inline V floorv(V a) { return _mm256_floor_ps(a.v); }
+inline V minv(V x, V y) { return _mm256_blendv_ps(x.v, y.v, _mm256_cmp_ps(y.v, x.v, _CMP_LT_OQ)); }
+inline V maxv(V x, V y) { return _mm256_blendv_ps(x.v, y.v, _mm256_cmp_ps(x.v, y.v, _CMP_LT_OQ)); }
+inline V stepv(V edge, V x) { return _mm256_andnot_ps(_mm256_cmp_ps(x.v, edge.v, _CMP_LT_OQ), _mm256_set1_ps(1.0f)); }
+inline V absv(V a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v); }
+inline V negv(V a) { return _mm256_xor_ps(_mm256_set1_ps(-0.0f), a.v); }
+
+#include "noise_simd.inl"
+
+}
+
+void fbmBatchAVX2(const float *x, const float *y, const float *z, float *out, size_t count, int iterations, float noiseOffset) {
+	fbmBatchLanes(x, y, z, out, count, iterations, noiseOffset);
+}
+
+#endif
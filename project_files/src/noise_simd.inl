@@ -0,0 +1,129 @@
+// Lane-parallel body of getNoiseAt/fbm from noise.cpp, shared by noise_sse41.cpp and noise_avx2.cpp.
+// The including file defines a lane type V (one float per sample) with + - * / operators and the
+// helpers below before including this file. Every step repeats the scalar operation order in
+// noise.cpp, so each lane is bit-identical to the scalar result.
+//
+//	V(float)				broadcast
+//	V::load/V::store		unaligned load/store of V::width floats
+//	floorv, minv, maxv		component floor, glm::min, glm::max
+//	stepv(edge, x)			glm::step, x < edge ? 0 : 1
+//	absv, negv				sign clear and sign flip
+
+static inline V customModv(V inc) {
+	return inc - floorv(inc / V(289.0f)) * V(289.0f);
+}
+
+static inline V permutev(V x) {
+	return customModv((x * V(34.0f) + V(1.0f)) * x);
+}
+
+static inline V noiseLanes(V spx, V spy, V spz) {
+	const V cx = V(1.0f / 6.0f);
+	const V cy = V(1.0f / 3.0f);
+
+	// four corners
+	V s = spx * cy + spy * cy + spz * cy;
+	V initx = floorv(spx + s);
+	V inity = floorv(spy + s);
+	V initz = floorv(spz + s);
+	V t = initx * cx + inity * cx + initz * cx;
+	V c1x = spx - initx + t;
+	V c1y = spy - inity + t;
+	V c1z = spz - initz + t;
+
+	V ax = stepv(c1y, c1x);
+	V ay = stepv(c1z, c1y);
+	V az = stepv(c1x, c1z);
+	V bx = V(1.0f) - ax;
+	V by = V(1.0f) - ay;
+	V bz = V(1.0f) - az;
+	V i1x = minv(ax, bz), i1y = minv(ay, bx), i1z = minv(az, by);
+	V i2x = maxv(ax, bz), i2y = maxv(ay, bx), i2z = maxv(az, by);
+
+	V cxs[4] = { c1x, c1x - i1x + cx, c1x - i2x + cy, c1x - V(0.5f) };
+	V cys[4] = { c1y, c1y - i1y + cx, c1y - i2y + cy, c1y - V(0.5f) };
+	V czs[4] = { c1z, c1z - i1z + cx, c1z - i2z + cy, c1z - V(0.5f) };
+
+	// permutations
+	initx = customModv(initx);
+	inity = customModv(inity);
+	initz = customModv(initz);
+	V offx[4] = { V(0.0f), i1x, i2x, V(1.0f) };
+	V offy[4] = { V(0.0f), i1y, i2y, V(1.0f) };
+	V offz[4] = { V(0.0f), i1z, i2z, V(1.0f) };
+
+	V sum01 = V(0.0f);
+	V sum23 = V(0.0f);
+	for (int c = 0; c < 4; c++) {
+		V perm = permutev(permutev(permutev(initz + offz[c]) + inity + offy[c]) + initx + offx[c]);
+		V permAdj = perm - V(49.0f) * floorv(perm / V(49.0f));
+
+		// gradients
+		V d1 = floorv(permAdj / V(7.0f));
+		V d2 = floorv(permAdj - V(7.0f) * d1);
+		V x = (d1 * V(2.0f) + V(0.5f)) / V(7.0f) - V(1.0f);
+		V y = (d2 * V(2.0f) + V(0.5f)) / V(7.0f) - V(1.0f);
+		V h = V(1.0f) - absv(x) - absv(y);
+		V k = negv(stepv(h, V(0.0f)));
+
+		V gx = x + (floorv(x) * V(2.0f) + V(1.0f)) * k;
+		V gy = y + (floorv(y) * V(2.0f) + V(1.0f)) * k;
+		V gz = h;
+
+		// interpolation
+		V norm = V(1.79284291400159f) - (gx * gx + gy * gy + gz * gz) * V(0.85373472095314f);
+		gx = gx * norm;
+		gy = gy * norm;
+		gz = gz * norm;
+
+		V maxv_ = maxv(V(0.6f) - (cxs[c] * cxs[c] + cys[c] * cys[c] + czs[c] * czs[c]), V(0.0f));
+		maxv_ = maxv_ * maxv_;
+		maxv_ = maxv_ * maxv_;
+
+		V p = cxs[c] * gx + cys[c] * gy + czs[c] * gz;
+
+		// glm::dot on vec4 sums pairwise: (x + y) + (z + w)
+		if (c < 2) {
+			sum01 = (c == 0) ? maxv_ * p : sum01 + maxv_ * p;
+		}
+		else {
+			sum23 = (c == 2) ? maxv_ * p : sum23 + maxv_ * p;
+		}
+	}
+
+	return V(50.0f) * (sum01 + sum23);
+}
+
+static inline V fbmLanes(V px, V py, V pz, int iterations, V noiseOffset) {
+	V sum = V(0.0f);
+	float amplitude = 1.0f;
+	float frequency = 1.0f;
+	for (int i = 0; i < iterations; i++) {
+		V f = V(frequency);
+		sum = sum + noiseLanes(px * f + noiseOffset, py * f + noiseOffset, pz * f + noiseOffset) * V(amplitude);
+		frequency *= 2.0f;
+		amplitude *= 0.5f;
+	}
+	return sum;
+}
+
+// Run fbmLanes over count samples, padding the tail so the last partial group is also vectorized
+static void fbmBatchLanes(const float *x, const float *y, const float *z, float *out, size_t count, int iterations, float noiseOffset) {
+	const V offset = V(noiseOffset);
+	size_t i = 0;
+	for (; i + V::width <= count; i += V::width) {
+		V::store(out + i, fbmLanes(V::load(x + i), V::load(y + i), V::load(z + i), iterations, offset));
+	}
+	if (i < count) {
+		float tx[V::width] = {}, ty[V::width] = {}, tz[V::width] = {}, to[V::width];
+		for (size_t j = i; j < count; j++) {
+			tx[j - i] = x[j];
+			ty[j - i] = y[j];
+			tz[j - i] = z[j];
+		}
+		V::store(to, fbmLanes(V::load(tx), V::load(ty), V::load(tz), iterations, offset));
+		for (size_t j = i; j < count; j++) {
+			out[j] = to[j - i];
+		}
+	}
+}
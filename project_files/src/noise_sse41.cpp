@@ -0,0 +1,41 @@
+// SSE4.1 build of the batched noise kernel, compiled with -msse4.1 (see Makefile).
+// Only include intrinsics here: inline code from other headers compiled with these flags
+// could be picked by the linker for the whole program.
+#include <cstddef>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+
+namespace {
+
+struct V {
+	static const size_t width = 4;
+	__m128 v;
+
+	V() {}
+	V(__m128 x) : v(x) {}
+	V(float x) : v(_mm_set1_ps(x)) {}
+	static V load(const float *p) { return _mm_loadu_ps(p); }
+	static void store(float *p, V x) { _mm_storeu_ps(p, x.v); }
+};
+
+inline V operator+(V a, V b) { return _mm_add_ps(a.v, b.v); }
+inline V operator-(V a, V b) { return _mm_sub_ps(a.v, b.v); }
+inline V operator*(V a, V b) { return _mm_mul_ps(a.v, b.v); }
+inline V operator/(V a, V b) { return _mm_div_ps(a.v, b.v); }
+inline V floorv(V a) { return _mm_floor_ps(a.v); }
+inline V minv(V x, V y) { return _mm_blendv_ps(x.v, y.v, _mm_cmplt_ps(y.v, x.v)); }
+inline V maxv(V x, V y) { return _mm_blendv_ps(x.v, y.v, _mm_cmplt_ps(x.v, y.v)); }
+inline V stepv(V edge, V x) { return _mm_andnot_ps(_mm_cmplt_ps(x.v, edge.v), _mm_set1_ps(1.0f)); }
+inline V absv(V a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v); }
+inline V negv(V a) { return _mm_xor_ps(_mm_set1_ps(-0.0f), a.v); }
+
+#include "noise_simd.inl"
+
+}
+
+void fbmBatchSSE41(const float *x, const float *y, const float *z, float *out, size_t count, int iterations, float noiseOffset) {
+	fbmBatchLanes(x, y, z, out, count, iterations, noiseOffset);
+}
+
+#endif
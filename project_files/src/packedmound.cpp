@@ -0,0 +1,43 @@
+#include "packedmound.hpp"
+#include <algorithm>
+#include <cmath>
+
+PackedMound packMound(glm::vec3 center, float radius, float height) {
+	const float halfMax = 65504.0f;
+	PackedMound m;
+	m.radius = glm::packHalf1x16(glm::clamp(radius, -halfMax, halfMax));
+	m.height = glm::packHalf1x16(glm::clamp(height, -halfMax, halfMax));
+
+	// Project onto the octahedron |x| + |y| + |z| = 1 and unfold its lower half
+	glm::vec3 d = glm::normalize(center);
+	if (!std::isfinite(d.x) || !std::isfinite(d.y) || !std::isfinite(d.z)) {
+		d = glm::vec3(0.0f, 0.0f, 1.0f); // A zero or infinite center has no direction, NaN codes would reach the shader
+	}
+	glm::vec2 o = glm::vec2(d.x, d.y) / (std::abs(d.x) + std::abs(d.y) + std::abs(d.z));
+	if (d.z < 0.0f) {
+		o = glm::vec2((1.0f - std::abs(o.y)) * ((o.x >= 0.0f) ? 1.0f : -1.0f), (1.0f - std::abs(o.x)) * ((o.y >= 0.0f) ? 1.0f : -1.0f));
+	}
+
+	// Rounding each coordinate is not always the closest code, try the four around it (by distance, dot
+	// products of such close directions all round to 1). An unpacked center then packs to the same code
+	glm::vec2 base = glm::floor(glm::clamp(o, -1.0f, 1.0f) * 32767.0f);
+	float bestDistance = 8.0f;
+	for (int corner = 0; corner < 4; corner++) {
+		glm::vec2 code = glm::clamp(base + glm::vec2((float)(corner & 1), (float)(corner >> 1)), -32767.0f, 32767.0f);
+		// On the folded edges the sign of the other coordinate is lost, keep one code per direction
+		if (std::abs(code.y) == 32767.0f) {
+			code.x = std::abs(code.x);
+		}
+		if (std::abs(code.x) == 32767.0f) {
+			code.y = std::abs(code.y);
+		}
+		uint32_t packed = glm::packSnorm2x16(code / 32767.0f);
+		glm::vec3 e = octahedralDirection(glm::unpackSnorm2x16(packed)) - d;
+		float distance = glm::dot(e, e);
+		if (distance < bestDistance) {
+			bestDistance = distance;
+			m.center = packed;
+		}
+	}
+	return m;
+}
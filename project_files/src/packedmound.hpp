@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+// User mound with its values spelled out
+struct Mound
+{
+	glm::vec3 center;	// On the unit sphere
+	float radius;
+	float height;
+};
+
+// User mound in 8 bytes, the form TerrainEditor stores, saves and uploads (a RGBA16I texel, fetched by
+// fetchMound() in f.glsl). The center direction is octahedral encoded in two snorm16, which keeps it
+// within 3e-5 radians. Radius and height are half floats, about 3 significant digits
+struct PackedMound
+{
+	uint32_t center = 0;	// glm::packSnorm2x16 of the octahedral coordinates
+	uint16_t radius = 0;	// glm::packHalf1x16
+	uint16_t height = 0;
+
+	inline bool operator==(const PackedMound &o) const { return (center == o.center) && (radius == o.radius) && (height == o.height); }
+	inline bool operator!=(const PackedMound &o) const { return !(*this == o); }
+};
+static_assert(sizeof(PackedMound) == 8, "PackedMound must be one RGBA16I texel");
+
+PackedMound packMound(glm::vec3 center, float radius, float height); // Center only needs a direction (+Z if it has none), radius and height are clamped to the half range
+
+// Octahedral coordinates in [-1, 1]^2 back to a unit direction
+inline glm::vec3 octahedralDirection(glm::vec2 o) {
+	glm::vec3 v = glm::vec3(o.x, o.y, 1.0f - std::abs(o.x) - std::abs(o.y));
+	if (v.z < 0.0f) {
+		// Lower half is folded over the diagonals
+		v.x = (1.0f - std::abs(o.y)) * ((o.x >= 0.0f) ? 1.0f : -1.0f);
+		v.y = (1.0f - std::abs(o.x)) * ((o.y >= 0.0f) ? 1.0f : -1.0f);
+	}
+	return glm::normalize(v);
+}
+
+// Same value as glm::unpackHalf1x16 for every finite half, without branches: the half's exponent and
+// mantissa bits shifted into a float are the value scaled by 2^-112, subnormals included
+inline float halfToFloat(uint16_t h) {
+	uint32_t bits = (uint32_t)(h & 0x7FFFu) << 13;
+	float magnitude;
+	std::memcpy(&magnitude, &bits, sizeof(float));
+	magnitude *= 5.192296858534828e33f; // 2^112
+	return (h & 0x8000u) ? -magnitude : magnitude;
+}
+
+inline Mound unpackMound(const PackedMound &m) {
+	return { octahedralDirection(glm::unpackSnorm2x16(m.center)), halfToFloat(m.radius), halfToFloat(m.height) };
+}
@@ -1,4 +1,5 @@
 #include "planet.hpp"
+#include "noise.hpp"
 #include <iostream>
 
 PlanetSphere::PlanetSphere(int width, int height) : _h(height), _w(width) {
@@ -72,8 +73,12 @@ void PlanetSphere::updateRotation() {
 	}
 
 	// Update rotation
-	rotationRad = rotationRad + rotationVelocity;
-	
+	if (isSpinning()) {
+		rotationRad = rotationRad + rotationVelocity;
+		_revision++;
+	}
+	rotation = rotateYXMatrix(rotationRad);
+
 }
 
 
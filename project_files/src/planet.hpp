@@ -21,12 +21,16 @@ public:
 	void endRotation();
 	void rotate(glm::vec2 mousePos);
 	void updateRotation(); // Sets radians of rotation based on velocity
+	inline bool isSpinning() { return rotationVelocity != glm::vec2(0.0f); } // Next updateRotation() will move the planet
+	inline unsigned int getRevision() { return _revision; } // Changes whenever rotation changes
 
 	glm::vec2 rotationRad = glm::vec2(0.0f, 0.0f);
+	glm::mat3 rotation = glm::mat3(1.0f); // World to planet space for rotationRad, rebuilt once per frame by updateRotation()
 	glm::vec2 rotationVelocity = glm::vec2(0.0f, 0.0f);
 private:
 	int _h, _w;
 	glm::vec2 _initMousePos = glm::vec2(0.0f, 0.0f);
 	glm::vec2 _rotationAcceleration = glm::vec2(0.0f, 0.0f);
+	unsigned int _revision = 0; // Bumped by every updateRotation() that moves the planet
 };
 
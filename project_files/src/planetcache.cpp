@@ -0,0 +1,156 @@
+#include "planetcache.hpp"
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+
+/*####################
+####      Key     ####
+####################*/
+
+bool PlanetKey::operator==(const PlanetKey &other) const {
+	return (seed == other.seed) && (detail == other.detail) && (editHash == other.editHash) && (resolution == other.resolution);
+}
+
+std::string PlanetKey::toString() const {
+	std::stringstream ss;
+	ss << "s" << seed << "_d" << detail << "_r" << resolution << "_e" << std::hex << std::setw(16) << std::setfill('0') << editHash;
+	return ss.str();
+}
+
+size_t PlanetKeyHash::operator()(const PlanetKey &key) const {
+	uint64_t h = key.editHash;
+	h = h * 31 + (uint32_t)key.seed;
+	h = h * 31 + (uint32_t)key.detail;
+	h = h * 31 + (uint32_t)key.resolution;
+	return (size_t)h;
+}
+
+
+/*####################
+####    Memory    ####
+####################*/
+
+PlanetCache::PlanetCache(size_t budgetBytes) : _budget(budgetBytes) {}
+
+PlanetCache::~PlanetCache() {
+	// Release OpenGL resources
+	for (auto &entry : _entries) {
+		glDeleteTextures(1, &entry.cubemap);
+	}
+}
+
+const PlanetCache::Entry *PlanetCache::find(const PlanetKey &key) {
+	auto it = _lookup.find(key);
+	if (it == _lookup.end()) {
+		return nullptr;
+	}
+	_entries.splice(_entries.begin(), _entries, it->second); // Move to front
+	return &_entries.front();
+}
+
+void PlanetCache::insert(const Entry &entry, const PlanetKey &inUse) {
+	auto it = _lookup.find(entry.key);
+	if (it != _lookup.end()) {
+		// Replace an older bake of the same planet
+		_bytesUsed -= it->second->bytes;
+		glDeleteTextures(1, &it->second->cubemap);
+		_entries.erase(it->second);
+	}
+	_entries.push_front(entry);
+	_lookup[entry.key] = _entries.begin();
+	_bytesUsed += entry.bytes;
+	_evict(inUse);
+}
+
+void PlanetCache::setBudget(size_t bytes) {
+	_budget = bytes;
+}
+
+void PlanetCache::_evict(const PlanetKey &inUse) {
+	// Walk from the least recently used end, keeping the newest entry and the one on screen
+	auto it = _entries.end();
+	while ((_bytesUsed > _budget) && (it != _entries.begin())) {
+		--it;
+		if ((it == _entries.begin()) || (it->key == inUse)) {
+			continue;
+		}
+		_bytesUsed -= it->bytes;
+		glDeleteTextures(1, &it->cubemap);
+		_lookup.erase(it->key);
+		it = _entries.erase(it);
+	}
+}
+
+
+/*####################
+####     Disk     ####
+####################*/
+
+// File layout: header followed by the six faces as raw floats
+struct BakeFileHeader {
+	char magic[8];
+	uint32_t displaceVersion;	// TerrainEditor::displaceVersion the bake was made with
+	int32_t resolution;
+	float minHeight;
+	float maxHeight;
+};
+
+static const char bakeFileMagic[8] = { 'P', 'P', 'B', 'A', 'K', 'E', '2', '\0' };
+
+void PlanetCache::setDiskDirectory(std::string directory) {
+	_diskDirectory = directory;
+	std::error_code error;
+	if (!_diskDirectory.empty() && !std::filesystem::create_directories(_diskDirectory, error) && error) {
+		std::cerr << "Bake cache directory " << _diskDirectory << " not created: " << error.message() << std::endl;
+	}
+}
+
+bool PlanetCache::loadFromDisk(const std::string &directory, const PlanetKey &key, Heightfield &field) {
+	if (directory.empty()) {
+		return false;
+	}
+	std::ifstream f(std::filesystem::path(directory) / (key.toString() + ".bake"), std::ios::binary);
+	if (!f.is_open()) {
+		return false;
+	}
+
+	BakeFileHeader header;
+	// Bakes of an older file layout or terrain formula are not this planet, they get baked again and overwritten
+	if (!f.read((char *)&header, sizeof(header)) || (std::memcmp(header.magic, bakeFileMagic, sizeof(bakeFileMagic)) != 0)
+		|| (header.displaceVersion != TerrainEditor::displaceVersion) || (header.resolution != key.resolution)) {
+		return false;
+	}
+	field.resolution = header.resolution;
+	field.minHeight = header.minHeight;
+	field.maxHeight = header.maxHeight;
+	field.heights.resize((size_t)6 * header.resolution * header.resolution);
+	return (bool)f.read((char *)field.heights.data(), field.sizeInBytes());
+}
+
+bool PlanetCache::saveToDisk(const std::string &directory, const PlanetKey &key, const Heightfield &field) {
+	if (directory.empty()) {
+		return false;
+	}
+	// The bake is still used from memory, a disk that stopped taking files only costs the next restart a bake
+	std::filesystem::path path = std::filesystem::path(directory) / (key.toString() + ".bake");
+	std::ofstream f(path, std::ios::binary | std::ofstream::trunc);
+	if (!f.is_open()) {
+		std::cerr << "Bake cache file " << path.string() << " not written: failed to open" << std::endl;
+		return false;
+	}
+
+	BakeFileHeader header;
+	std::memcpy(header.magic, bakeFileMagic, sizeof(bakeFileMagic));
+	header.displaceVersion = TerrainEditor::displaceVersion;
+	header.resolution = field.resolution;
+	header.minHeight = field.minHeight;
+	header.maxHeight = field.maxHeight;
+	f.write((const char *)&header, sizeof(header));
+	f.write((const char *)field.heights.data(), field.sizeInBytes());
+	if (!f) {
+		std::cerr << "Bake cache file " << path.string() << " not written: write failed" << std::endl;
+		return false;
+	}
+	return true;
+}
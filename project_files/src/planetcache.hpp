@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include "gl_core_3_3.h"
+#include "procedural.hpp"
+
+// Identifies one baked planet: everything the baked displacement depends on
+struct PlanetKey
+{
+	int seed = 0;
+	int detail = 0;
+	uint64_t editHash = 0;	// TerrainEditor::getEditHash()
+	int resolution = 0;		// Texels per cubemap face edge
+
+	bool operator==(const PlanetKey &other) const;
+	inline bool operator!=(const PlanetKey &other) const { return !(*this == other); }
+	std::string toString() const; // Also used as the file name in the disk tier
+};
+
+struct PlanetKeyHash
+{
+	size_t operator()(const PlanetKey &key) const;
+};
+
+// LRU of baked terrain cubemaps on the GPU, limited by a byte budget, with an optional on-disk tier
+// so previous bakes survive restarts. Evicted cubemaps are deleted, so the cache owns its textures.
+class PlanetCache
+{
+public:
+	struct Entry {
+		PlanetKey key;
+		GLuint cubemap = 0;
+		size_t bytes = 0;
+		float minHeight = 0.0f; // Heightfield range, kept for ray bounds
+		float maxHeight = 0.0f;
+	};
+
+	PlanetCache(size_t budgetBytes = (size_t)256 * 1024 * 1024);
+	~PlanetCache();
+	// Disallow copy, move, & assignment
+	PlanetCache(const PlanetCache& other) = delete;
+	PlanetCache& operator=(const PlanetCache& other) = delete;
+
+	const Entry *find(const PlanetKey &key); // Marks the entry most recently used, nullptr on a miss
+	void insert(const Entry &entry, const PlanetKey &inUse); // Evicts least recently used entries over budget, never inUse
+	void setBudget(size_t bytes);
+	inline size_t getBytesUsed() { return _bytesUsed; }
+	inline size_t getSize() { return _entries.size(); }
+
+	// Disk tier, disabled while the directory is empty. The file functions only touch the directory
+	// given to them, so TerrainBaker runs them on its thread. Failures are logged, never thrown
+	void setDiskDirectory(std::string directory);
+	inline const std::string &getDiskDirectory() const { return _diskDirectory; }
+	static bool loadFromDisk(const std::string &directory, const PlanetKey &key, Heightfield &field); // False on a miss or an unreadable file
+	static bool saveToDisk(const std::string &directory, const PlanetKey &key, const Heightfield &field); // False if the file could not be written
+
+private:
+	void _evict(const PlanetKey &inUse);
+
+	size_t _budget;
+	size_t _bytesUsed = 0;
+	std::list<Entry> _entries = {}; // Front is most recently used
+	std::unordered_map<PlanetKey, std::list<Entry>::iterator, PlanetKeyHash> _lookup = {};
+	std::string _diskDirectory = "";
+};
@@ -0,0 +1,296 @@
+#include "planetfile.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+/*####################
+####    Mapping   ####
+####################*/
+
+MappedFile::MappedFile(const std::string &filename) {
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		throw std::runtime_error("Failed to open file: " + filename);
+	}
+	LARGE_INTEGER size;
+	GetFileSizeEx(file, &size);
+	_file = file;
+	_size = (size_t)size.QuadPart;
+	if (_size > 0) {
+		// Empty files cannot be mapped, they stay a null view of size 0
+		_mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		_data = _mapping ? (const char *)MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+		if (!_data) {
+			if (_mapping) {
+				CloseHandle(_mapping);
+			}
+			CloseHandle(file);
+			throw std::runtime_error("Failed to map file: " + filename);
+		}
+	}
+#else
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0) {
+		throw std::runtime_error("Failed to open file: " + filename);
+	}
+	struct stat info;
+	if (fstat(fd, &info) != 0) {
+		close(fd);
+		throw std::runtime_error("Failed to read the size of file: " + filename);
+	}
+	_size = (size_t)info.st_size;
+	if (_size > 0) {
+		// Empty files cannot be mapped, they stay a null view of size 0
+		void *data = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) {
+			close(fd);
+			throw std::runtime_error("Failed to map file: " + filename);
+		}
+		_data = (const char *)data;
+	}
+	close(fd); // The mapping keeps the file open
+#endif
+}
+
+MappedFile::~MappedFile() {
+#ifdef _WIN32
+	if (_data) {
+		UnmapViewOfFile(_data);
+	}
+	if (_mapping) {
+		CloseHandle(_mapping);
+	}
+	if (_file) {
+		CloseHandle(_file);
+	}
+#else
+	if (_data) {
+		munmap((void *)_data, _size);
+	}
+#endif
+}
+
+
+/*####################
+####    Format    ####
+####################*/
+
+// File layout: header, level table, edits, then the heights of each level. Sections start on
+// 64 byte boundaries so everything can be read in place. Values are little endian
+struct PlanetFileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t headerBytes;	// sizeof(PlanetFileHeader) of the writer
+	int32_t seed;
+	int32_t detail;			// fbm iterations
+	float lacunarity;		// Noise parameters the planet was made with, see fbm() and displace()
+	float gain;
+	float heightScale;
+	float heightOffset;
+	uint64_t editHash;		// TerrainEditor::getEditHash()
+	uint64_t moundCount;
+	uint64_t moundOffset;	// PackedMound records
+	uint32_t levelCount;
+	uint32_t displaceVersion;	// TerrainEditor::displaceVersion the bake levels were made with
+	uint64_t levelOffset;	// PlanetFileLevel table
+};
+
+struct PlanetFileLevel {
+	int32_t resolution;
+	float minHeight;
+	float maxHeight;
+	uint32_t reserved;
+	uint64_t offset;		// Six faces of resolution^2 floats
+};
+
+static const char planetFileMagic[8] = { 'P', 'P', 'P', 'L', 'A', 'N', 'E', 'T' };
+
+// Values fbm() (noise.cpp, f.glsl) and TerrainEditor::displace() are written with, files made with
+// others describe a different planet
+static const float planetLacunarity = 2.0f;
+static const float planetGain = 0.5f;
+static const float planetHeightScale = 0.05f;
+static const float planetHeightOffset = -0.0075f;
+
+static const int maxLevels = 16;
+static const int maxLevelResolution = 16384;
+
+static uint64_t alignSection(uint64_t offset) {
+	return (offset + 63) & ~(uint64_t)63;
+}
+
+// Next level of a bake, each texel the average of the four it covers
+static Heightfield halveHeightfield(const Heightfield &field) {
+	Heightfield half;
+	half.resolution = field.resolution / 2;
+	half.heights.resize((size_t)6 * half.resolution * half.resolution);
+	half.minHeight = 1e30f;
+	half.maxHeight = -1e30f;
+	for (int f = 0; f < 6; f++) {
+		const float *src = field.face(f);
+		float *dst = half.face(f);
+		for (int y = 0; y < half.resolution; y++) {
+			const float *row0 = src + (size_t)(2 * y) * field.resolution;
+			const float *row1 = row0 + field.resolution;
+			for (int x = 0; x < half.resolution; x++) {
+				float h = 0.25f * (row0[2 * x] + row0[2 * x + 1] + row1[2 * x] + row1[2 * x + 1]);
+				dst[(size_t)y * half.resolution + x] = h;
+				half.minHeight = std::min(half.minHeight, h);
+				half.maxHeight = std::max(half.maxHeight, h);
+			}
+		}
+	}
+	return half;
+}
+
+
+/*####################
+####     Save     ####
+####################*/
+
+void PlanetFile::save(const std::string &filename, TerrainEditor &terrain, const Heightfield *bake, int levels) {
+	// The bake and its halvings, as far as the resolution divides
+	std::vector<Heightfield> halvings;
+	std::vector<const Heightfield *> fields;
+	if (bake && (bake->resolution > 0)) {
+		halvings.reserve(maxLevels);
+		fields.push_back(bake);
+		while (((int)fields.size() < std::min(levels, maxLevels)) && (fields.back()->resolution % 2 == 0)) {
+			halvings.push_back(halveHeightfield(*fields.back()));
+			fields.push_back(&halvings.back());
+		}
+	}
+
+	const std::vector<PackedMound> &mounds = terrain.getMounds();
+	PlanetFileHeader header = {};
+	std::memcpy(header.magic, planetFileMagic, sizeof(planetFileMagic));
+	header.version = version;
+	header.headerBytes = sizeof(PlanetFileHeader);
+	header.seed = terrain.getSeed();
+	header.detail = terrain.getDetailLevel();
+	header.lacunarity = planetLacunarity;
+	header.gain = planetGain;
+	header.heightScale = planetHeightScale;
+	header.heightOffset = planetHeightOffset;
+	header.editHash = terrain.getEditHash();
+	header.moundCount = mounds.size();
+	header.levelCount = (uint32_t)fields.size();
+	header.displaceVersion = TerrainEditor::displaceVersion;
+	header.levelOffset = sizeof(PlanetFileHeader);
+	header.moundOffset = alignSection(header.levelOffset + fields.size() * sizeof(PlanetFileLevel));
+
+	std::vector<PlanetFileLevel> table(fields.size());
+	uint64_t end = header.moundOffset + mounds.size() * sizeof(PackedMound);
+	for (size_t i = 0; i < fields.size(); i++) {
+		table[i].resolution = fields[i]->resolution;
+		table[i].minHeight = fields[i]->minHeight;
+		table[i].maxHeight = fields[i]->maxHeight;
+		table[i].offset = alignSection(end);
+		end = table[i].offset + fields[i]->sizeInBytes();
+	}
+
+	std::ofstream f(filename, std::ofstream::binary | std::ofstream::trunc);
+	if (!f.is_open()) {
+		throw std::runtime_error("Failed to open file: " + filename);
+	}
+	const char padding[64] = {};
+	auto padTo = [&](uint64_t offset) {
+		f.write(padding, (std::streamsize)(offset - (uint64_t)f.tellp()));
+	};
+	f.write((const char *)&header, sizeof(header));
+	f.write((const char *)table.data(), table.size() * sizeof(PlanetFileLevel));
+	padTo(header.moundOffset);
+	f.write((const char *)mounds.data(), mounds.size() * sizeof(PackedMound));
+	for (size_t i = 0; i < fields.size(); i++) {
+		padTo(table[i].offset);
+		f.write((const char *)fields[i]->heights.data(), fields[i]->sizeInBytes());
+	}
+	if (!f) {
+		throw std::runtime_error("Failed to write file: " + filename);
+	}
+}
+
+
+/*####################
+####     Load     ####
+####################*/
+
+PlanetFile::PlanetFile(const std::string &filename) : _file(filename) {
+	auto fail = [&](std::string message) {
+		throw std::runtime_error(filename + ": " + message);
+	};
+	// A section fits the file and its values can be read in place
+	auto inFile = [&](uint64_t offset, uint64_t count, size_t itemBytes, size_t alignment) {
+		return (offset <= _file.size()) && (count <= (_file.size() - offset) / itemBytes) && (offset % alignment == 0);
+	};
+
+	PlanetFileHeader header;
+	if ((_file.size() < sizeof(header.magic)) || (std::memcmp(_file.data(), planetFileMagic, sizeof(planetFileMagic)) != 0)) {
+		fail("not a planet file");
+	}
+	if (_file.size() < sizeof(header)) {
+		fail("file ends inside the header");
+	}
+	std::memcpy(&header, _file.data(), sizeof(header));
+	if (header.version > version) {
+		fail("version " + std::to_string(header.version) + ", this build reads up to " + std::to_string(version));
+	}
+	if (header.headerBytes < sizeof(PlanetFileHeader)) {
+		fail("header of " + std::to_string(header.headerBytes) + " bytes is too short");
+	}
+	if ((header.lacunarity != planetLacunarity) || (header.gain != planetGain) || (header.heightScale != planetHeightScale) || (header.heightOffset != planetHeightOffset)) {
+		fail("made with different noise parameters than this build");
+	}
+	if ((header.detail < 0) || (header.detail > 12)) {
+		fail("detail " + std::to_string(header.detail) + " is outside [0, 12]");
+	}
+	_seed = header.seed;
+	_detail = header.detail;
+	_editHash = header.editHash;
+
+	if (!inFile(header.moundOffset, header.moundCount, sizeof(PackedMound), alignof(PackedMound))) {
+		fail("edit table is outside the file");
+	}
+	_mounds = (const PackedMound *)(_file.data() + header.moundOffset);
+	_moundCount = (size_t)header.moundCount;
+	if (TerrainEditor::hashEdits(_mounds, _moundCount) != _editHash) {
+		fail("edits do not match their hash, the file is damaged");
+	}
+
+	if ((header.levelCount > maxLevels) || !inFile(header.levelOffset, header.levelCount, sizeof(PlanetFileLevel), 1)) {
+		fail("bake level table is outside the file");
+	}
+	for (uint32_t i = 0; i < header.levelCount; i++) {
+		PlanetFileLevel entry;
+		std::memcpy(&entry, _file.data() + header.levelOffset + i * sizeof(PlanetFileLevel), sizeof(entry));
+		if ((entry.resolution <= 0) || (entry.resolution > maxLevelResolution)) {
+			fail("bake level " + std::to_string(i) + " has resolution " + std::to_string(entry.resolution));
+		}
+		if (!inFile(entry.offset, (uint64_t)6 * entry.resolution * entry.resolution, sizeof(float), alignof(float))) {
+			fail("bake level " + std::to_string(i) + " is outside the file");
+		}
+		Level level;
+		level.resolution = entry.resolution;
+		level.minHeight = entry.minHeight;
+		level.maxHeight = entry.maxHeight;
+		level.heights = (const float *)(_file.data() + entry.offset);
+		_levels.push_back(level);
+	}
+	if (header.displaceVersion != TerrainEditor::displaceVersion) {
+		_levels.clear(); // Heights of an older terrain formula, the edits still describe the planet
+	}
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "procedural.hpp"
+
+// Read-only memory mapping of a whole file, pages are read from disk when first touched
+class MappedFile
+{
+public:
+	MappedFile(const std::string &filename); // Throws if the file cannot be opened or mapped
+	~MappedFile();
+	// Disallow copy, move, & assignment
+	MappedFile(const MappedFile& other) = delete;
+	MappedFile& operator=(const MappedFile& other) = delete;
+
+	inline const char *data() const { return _data; }
+	inline size_t size() const { return _size; }
+
+private:
+	const char *_data = nullptr;
+	size_t _size = 0;
+#ifdef _WIN32
+	void *_file = nullptr;
+	void *_mapping = nullptr;
+#endif
+};
+
+// Binary planet (.planet): versioned header with the seed, detail and noise parameters, the edits as
+// PackedMound records and optionally the baked heightfield at halving resolutions. Opening maps the
+// file and only checks it, the records and heights are read in place
+class PlanetFile
+{
+public:
+	static const uint32_t version = 1; // Files of later versions are refused
+
+	struct Level {
+		int resolution = 0;
+		float minHeight = 0.0f;
+		float maxHeight = 0.0f;
+		const float *heights = nullptr; // Six faces, same layout as Heightfield::heights
+	};
+
+	PlanetFile(const std::string &filename); // Map and validate, throws naming the file and the problem
+	// Disallow copy, move, & assignment
+	PlanetFile(const PlanetFile& other) = delete;
+	PlanetFile& operator=(const PlanetFile& other) = delete;
+
+	inline int getSeed() const { return _seed; }
+	inline int getDetail() const { return _detail; }
+	inline uint64_t getEditHash() const { return _editHash; } // TerrainEditor::getEditHash() of the edits
+	inline const PackedMound *getMounds() const { return _mounds; }
+	inline size_t getMoundCount() const { return _moundCount; }
+	inline const std::vector<Level> &getLevels() const { return _levels; } // Largest first, empty without a bake or if it is of another TerrainEditor::displaceVersion
+
+	// Write the editor's planet. A bake of it (resolution a power of two) is stored with up to
+	// levels - 1 box filtered halvings below it
+	static void save(const std::string &filename, TerrainEditor &terrain, const Heightfield *bake = nullptr, int levels = 1);
+
+private:
+	MappedFile _file;
+	int _seed = 0;
+	int _detail = 0;
+	uint64_t _editHash = 0;
+	const PackedMound *_mounds = nullptr;
+	size_t _moundCount = 0;
+	std::vector<Level> _levels = {};
+};
@@ -1,8 +1,381 @@
 #include "procedural.hpp"
+#include "noise.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <atomic>
+#include <iomanip>
+#include <thread>
+
+/*####################
+####  Heightfield ####
+####################*/
+
+glm::vec3 Heightfield::texelDirection(int face, int x, int y, int resolution) {
+	// Texel center in [-1, 1], mapped to a cube face the same way OpenGL selects cubemap faces
+	float s = 2.0f * ((float)x + 0.5f) / (float)resolution - 1.0f;
+	float t = 2.0f * ((float)y + 0.5f) / (float)resolution - 1.0f;
+	glm::vec3 dir;
+	switch (face)
+	{
+	case 0: dir = glm::vec3(1.0f, -t, -s); break;	// +X
+	case 1: dir = glm::vec3(-1.0f, -t, s); break;	// -X
+	case 2: dir = glm::vec3(s, 1.0f, t); break;		// +Y
+	case 3: dir = glm::vec3(s, -1.0f, -t); break;	// -Y
+	case 4: dir = glm::vec3(s, -t, 1.0f); break;	// +Z
+	default: dir = glm::vec3(-s, -t, -1.0f); break;	// -Z
+	}
+	return glm::normalize(dir);
+}
+
+float Heightfield::sample(glm::vec3 direction) const {
+	if (resolution == 0) {
+		return 0.0f;
+	}
+
+	// Pick face from the major axis
+	glm::vec3 a = glm::abs(direction);
+	int f;
+	float sc, tc, ma;
+	if ((a.x >= a.y) && (a.x >= a.z)) {
+		f = (direction.x > 0.0f) ? 0 : 1;
+		sc = (direction.x > 0.0f) ? -direction.z : direction.z;
+		tc = -direction.y;
+		ma = a.x;
+	}
+	else if (a.y >= a.z) {
+		f = (direction.y > 0.0f) ? 2 : 3;
+		sc = direction.x;
+		tc = (direction.y > 0.0f) ? direction.z : -direction.z;
+		ma = a.y;
+	}
+	else {
+		f = (direction.z > 0.0f) ? 4 : 5;
+		sc = (direction.z > 0.0f) ? direction.x : -direction.x;
+		tc = -direction.y;
+		ma = a.z;
+	}
+
+	// Bilinear filter within the face, clamped at its edges
+	float u = glm::clamp((sc / ma + 1.0f) * 0.5f * resolution - 0.5f, 0.0f, (float)(resolution - 1));
+	float v = glm::clamp((tc / ma + 1.0f) * 0.5f * resolution - 0.5f, 0.0f, (float)(resolution - 1));
+	int x0 = (int)u;
+	int y0 = (int)v;
+	int x1 = std::min(x0 + 1, resolution - 1);
+	int y1 = std::min(y0 + 1, resolution - 1);
+	float fx = u - (float)x0;
+	float fy = v - (float)y0;
+
+	const float *data = face(f);
+	float top = glm::mix(data[y0 * resolution + x0], data[y0 * resolution + x1], fx);
+	float bottom = glm::mix(data[y1 * resolution + x0], data[y1 * resolution + x1], fx);
+	return glm::mix(top, bottom, fy);
+}
+
+
+/*####################
+####  Edit field  ####
+####################*/
+
+// Texels of one face whose centers can lie in the cone of directions around axis (unit) within angle.
+// Per face, the other two components over the cone are bounded by their angle to the axis, and
+// dividing by the major component (at least m) maps them to face coordinates, as in MoundIndex::add
+static EditField::Rect coneTexels(int face, glm::vec3 axis, float angle, int resolution) {
+	const float pi = 3.14159265f;
+	// Major axis of each face and its face coordinates as (component, sign), see Heightfield::texelDirection
+	static const int major[6] = { 0, 0, 1, 1, 2, 2 };
+	static const int sAxis[6][2] = { { 2, -1 }, { 2, 1 }, { 0, 1 }, { 0, 1 }, { 0, 1 }, { 0, -1 } };
+	static const int tAxis[6][2] = { { 1, -1 }, { 1, -1 }, { 2, 1 }, { 2, -1 }, { 1, -1 }, { 1, -1 } };
+
+	EditField::Rect rect;
+	float toFace = std::acos(glm::clamp((face & 1) ? -axis[major[face]] : axis[major[face]], -1.0f, 1.0f));
+	if (toFace - angle > 0.9553166f) {
+		return rect; // Face directions are at most atan(sqrt(2)) from the face axis
+	}
+	rect = { 0, 0, resolution - 1, resolution - 1 };
+	float farthest = toFace + angle;
+	if (farthest >= 0.5f * pi - 0.01f) {
+		return rect; // Reaches the face horizon
+	}
+
+	float m = std::cos(farthest);
+	auto texelRange = [&](const int component[2], int &lo, int &hi) {
+		float phi = std::acos(glm::clamp(axis[component[0]] * (float)component[1], -1.0f, 1.0f));
+		float low = std::cos(std::min(phi + angle, pi));
+		float high = std::cos(std::max(phi - angle, 0.0f));
+		float sMin = (low < 0.0f) ? low / m : low;
+		float sMax = (high > 0.0f) ? high / m : high;
+		// Texel x is centered at s = 2 (x + 0.5) / resolution - 1
+		lo = glm::clamp((int)std::floor((sMin + 1.0f) * 0.5f * resolution - 0.5f), 0, resolution - 1);
+		hi = glm::clamp((int)std::ceil((sMax + 1.0f) * 0.5f * resolution - 0.5f), 0, resolution - 1);
+	};
+	texelRange(sAxis[face], rect.x0, rect.x1);
+	texelRange(tAxis[face], rect.y0, rect.y1);
+	return rect;
+}
+
+void EditField::setResolution(int resolution) {
+	_field.resolution = resolution;
+	_field.heights.assign((size_t)6 * resolution * resolution, 0.0f);
+	for (Rect &changed : _changed) {
+		changed = { 0, 0, resolution - 1, resolution - 1 };
+	}
+}
+
+void EditField::splat(glm::vec3 center, float radius, float height) {
+	_accumulate(center, radius, height);
+}
+
+void EditField::erase(glm::vec3 center, float radius, float height) {
+	// moundHeight() is odd in height, so this subtracts the values splat() added. Float sums do not undo
+	// exactly, (a + b) - b leaves rounding residue (about 2e-8 after undoing every edit), far below the
+	// shader's bilinear error. rebuild() gives the exact sum again
+	_accumulate(center, radius, -height);
+}
+
+void EditField::rebuild(const PackedMound *mounds, size_t count) {
+	setResolution(_field.resolution);
+	if (_field.resolution == 0) {
+		return;
+	}
+	// Faces are disjoint, and each texel still sums its mounds in edit order
+	std::vector<std::thread> threads;
+	for (int face = 0; face < 6; face++) {
+		threads.emplace_back([=]() {
+			for (size_t i = 0; i < count; i++) {
+				Mound m = unpackMound(mounds[i]);
+				_accumulate(m.center, m.radius, m.height, face, face);
+			}
+		});
+	}
+	for (auto &thread : threads) {
+		thread.join();
+	}
+}
+
+void EditField::_accumulate(glm::vec3 center, float radius, float height, int firstFace, int lastFace) {
+	const float margin = 1e-3f; // Radians, the exact distance test per texel decides
+	const int n = _field.resolution;
+	if (n == 0) {
+		return;
+	}
+
+	// Directions whose unit point is within radius of the center form a cone around it. Its half angle
+	// follows from the triangle (origin, center, point) with sides 1, |center| and radius
+	float dist = glm::length(center);
+	float cosAngle = (dist > 0.0f) ? (1.0f + dist * dist - radius * radius) / (2.0f * dist) : ((radius >= 1.0f) ? -1.0f : 2.0f);
+	if (cosAngle > 1.0f) {
+		return; // Does not reach the unit sphere
+	}
+	glm::vec3 axis = (dist > 0.0f) ? center / dist : glm::vec3(0.0f, 0.0f, 1.0f);
+	float angle = std::acos(std::max(cosAngle, -1.0f)) + margin;
+
+	for (int face = firstFace; face <= lastFace; face++) {
+		Rect rect = coneTexels(face, axis, angle, n);
+		if (rect.empty()) {
+			continue;
+		}
+		float *data = _field.face(face);
+		for (int y = rect.y0; y <= rect.y1; y++) {
+			for (int x = rect.x0; x <= rect.x1; x++) {
+				data[y * n + x] += moundHeight(Heightfield::texelDirection(face, x, y, n), center, radius, height);
+			}
+		}
+
+		Rect &changed = _changed[face];
+		if (changed.empty()) {
+			changed = rect;
+		}
+		else {
+			changed = { std::min(changed.x0, rect.x0), std::min(changed.y0, rect.y0), std::max(changed.x1, rect.x1), std::max(changed.y1, rect.y1) };
+		}
+	}
+}
+
+EditField::Rect EditField::takeChanged(int face) {
+	Rect changed = _changed[face];
+	_changed[face] = Rect();
+	return changed;
+}
+
+
+/*####################
+####   Terrain    ####
+####################*/
 
 TerrainEditor::TerrainEditor() {}
 
-void TerrainEditor::generate() {}
+float TerrainEditor::displace(glm::vec3 p) {
+	_moundIndex.pack();
+	return _addMounds(p, fbm(p, _detail, (float)_seed)); // continents
+}
+
+float TerrainEditor::_addMounds(glm::vec3 p, float noise) {
+	float ret = noise;
+
+	// Generate user terrain, only mounds that can reach p's cell
+	int cell = MoundIndex::cellOf(p);
+	for (const uint32_t *i = _moundIndex.cellBegin(cell); i != _moundIndex.cellEnd(cell); ++i) {
+		Mound m = unpackMound(_mounds[*i]);
+		ret += moundHeight(p, m.center, m.radius, m.height) / 0.05f;
+	}
+
+	ret *= 0.05f; // normalize
+	ret -= 0.0075f;
+	return ret;
+}
+
+float TerrainEditor::displace(glm::vec3 p, const glm::mat3 &rotation) {
+	return displace(rotation * p);
+}
+
+glm::vec4 TerrainEditor::displaceD(glm::vec3 p) {
+	glm::vec4 ret = fbmD(p, _detail, (float)_seed); // continents
+
+	// Generate user terrain
+	_moundIndex.pack();
+	int cell = MoundIndex::cellOf(p);
+	for (const uint32_t *i = _moundIndex.cellBegin(cell); i != _moundIndex.cellEnd(cell); ++i) {
+		Mound m = unpackMound(_mounds[*i]);
+		ret += moundHeightD(p, m.center, m.radius, m.height) / 0.05f;
+	}
+
+	ret *= 0.05f; // normalize
+	ret.x -= 0.0075f;
+	return ret;
+}
+
+glm::vec4 TerrainEditor::displaceD(glm::vec3 p, const glm::mat3 &rotation) {
+	glm::vec4 ret = displaceD(rotation * p);
+	glm::vec3 grad = glm::transpose(rotation) * glm::vec3(ret.y, ret.z, ret.w); // back to world space
+	return glm::vec4(ret.x, grad);
+}
+
+glm::vec3 TerrainEditor::surfaceNormal(glm::vec3 p, const glm::mat3 &rotation) {
+	glm::vec4 d = displaceD(p, rotation);
+	return glm::normalize(glm::normalize(p) - glm::vec3(d.y, d.z, d.w));
+}
+
+void TerrainEditor::_updateMoundBounds() {
+	if (_moundBoundsRevision == _editRevision) {
+		return;
+	}
+	// Only the mounds of one index cell reach any point, so the extremes are the largest per cell sums
+	_moundIndex.pack();
+	_moundRange = glm::vec2(0.0f);
+	_moundSlope = 0.0f;
+	for (int cell = 0; cell < MoundIndex::numCells; cell++) {
+		glm::vec2 range = glm::vec2(0.0f);
+		float slope = 0.0f;
+		for (const uint32_t *i = _moundIndex.cellBegin(cell); i != _moundIndex.cellEnd(cell); ++i) {
+			// Mounds peak at their center, assume they all overlap
+			Mound m = unpackMound(_mounds[*i]);
+			if (m.height > 0.0f) {
+				range.y += m.height / 0.05f;
+			}
+			else {
+				range.x += m.height / 0.05f;
+			}
+			// A Gaussian mound is steepest one deviation (radius / 4) from its center: height / c * e^-1/2
+			slope += std::abs(m.height) / (m.radius / 4.0f) * std::exp(-0.5f);
+		}
+		_moundRange = glm::vec2(std::min(_moundRange.x, range.x), std::max(_moundRange.y, range.y));
+		_moundSlope = std::max(_moundSlope, slope);
+	}
+	_moundBoundsRevision = _editRevision;
+}
+
+glm::vec2 TerrainEditor::getDisplacementBounds() {
+	_updateMoundBounds();
+	float noise = fbmBound(_detail);
+	glm::vec2 bounds = glm::vec2(-noise, noise) + _moundRange;
+
+	bounds *= 0.05f; // normalize
+	bounds -= 0.0075f;
+	return bounds;
+}
+
+float TerrainEditor::getLipschitzBound() {
+	_updateMoundBounds();
+	float slope = 0.05f * fbmGradientBound(_detail) + _moundSlope;
+
+	// length(p) has slope 1
+	return 1.0f + slope;
+}
+
+bool TerrainEditor::generate(int resolution, const std::atomic<bool> *cancel) {
+	const int tileSize = 32;
+	const int tilesPerEdge = (resolution + tileSize - 1) / tileSize;
+	const int numTiles = 6 * tilesPerEdge * tilesPerEdge;
+	const float noiseOffset = (float)_seed;
+
+	_heightfield.resolution = resolution;
+	_heightfield.heights.assign((size_t)6 * resolution * resolution, 0.0f);
+	_moundIndex.pack(); // Workers only read it
+
+	// Workers pull tiles from a shared counter until every face is covered
+	std::atomic<int> nextTile(0);
+	auto worker = [&]() {
+		for (int tile = nextTile++; tile < numTiles; tile = nextTile++) {
+			if (cancel && *cancel) {
+				return; // Stale bake, drop the remaining tiles
+			}
+			int face = tile / (tilesPerEdge * tilesPerEdge);
+			int tileX = (tile % tilesPerEdge) * tileSize;
+			int tileY = ((tile / tilesPerEdge) % tilesPerEdge) * tileSize;
+			int tileW = std::min(tileX + tileSize, resolution) - tileX;
+			float *data = _heightfield.face(face);
+
+			// One row at a time through the batched fbm kernel
+			float px[tileSize], py[tileSize], pz[tileSize], noise[tileSize];
+			for (int y = tileY; y < std::min(tileY + tileSize, resolution); y++) {
+				for (int x = 0; x < tileW; x++) {
+					glm::vec3 p = Heightfield::texelDirection(face, tileX + x, y, resolution);
+					px[x] = p.x;
+					py[x] = p.y;
+					pz[x] = p.z;
+				}
+				fbmBatch(px, py, pz, noise, tileW, _detail, noiseOffset);
+				for (int x = 0; x < tileW; x++) {
+					data[y * resolution + tileX + x] = _addMounds(glm::vec3(px[x], py[x], pz[x]), noise[x]);
+				}
+			}
+		}
+	};
+
+	unsigned int numThreads = std::max(1u, std::thread::hardware_concurrency());
+	std::vector<std::thread> threads;
+	for (unsigned int t = 1; t < numThreads; t++) {
+		threads.emplace_back(worker);
+	}
+	worker(); // Calling thread takes tiles too
+	for (auto &t : threads) {
+		t.join();
+	}
+	if (cancel && *cancel) {
+		return false;
+	}
+
+	auto range = std::minmax_element(_heightfield.heights.begin(), _heightfield.heights.end());
+	_heightfield.minHeight = *range.first;
+	_heightfield.maxHeight = *range.second;
+	return true;
+}
+
+uint64_t TerrainEditor::getEditHash() {
+	return hashEdits(_mounds.data(), _mounds.size());
+}
+
+uint64_t TerrainEditor::hashEdits(const PackedMound *mounds, size_t count) {
+	// FNV-1a over the packed edits
+	uint64_t hash = 14695981039346656037ull;
+	const unsigned char *b = (const unsigned char *)mounds;
+	for (size_t i = 0; i < count * sizeof(PackedMound); i++) {
+		hash = (hash ^ b[i]) * 1099511628211ull;
+	}
+	return hash;
+}
 
 void TerrainEditor::save(std::string filename) {
 	// Open file for output, ensuring file is cleared
@@ -11,10 +384,13 @@ void TerrainEditor::save(std::string filename) {
 	if (!f.is_open()) {
 		throw std::runtime_error("Failed to open file: " + filename);
 	}
+	// Enough digits that loading packs every mound to the same record again
+	f << std::setprecision(9);
 	for (size_t i = 0; i < getAddedTerrainArraySize(); i++) {
-		glm::vec3 p = _pArray[i];
-		float r = _rArray[i];
-		float h = _hArray[i];
+		Mound m = getMound(i);
+		glm::vec3 p = m.center;
+		float r = m.radius;
+		float h = m.height;
 		f << p.x << std::endl;
 		f << p.y << std::endl;
 		f << p.z << std::endl;
@@ -26,78 +402,113 @@ void TerrainEditor::save(std::string filename) {
 }
 
 void TerrainEditor::load(std::string filename) {
-	// Open file for input
-	std::ifstream f(filename);
+	// Read the whole file at once, the parser works on the buffer in place
+	std::ifstream f(filename, std::ifstream::in | std::ifstream::binary);
 
 	if (!f.is_open()) {
 		throw std::runtime_error("Failed to open file: " + filename);
 	}
-
-	// Load lines into a vector
-	std::vector<std::string> lines;
-	std::string r;
-	while (std::getline(f, r, '\n')) {
-		lines.push_back(r);
+	f.seekg(0, std::ifstream::end);
+	std::streamoff size = f.tellg();
+	if (size < 0) {
+		throw std::runtime_error("Failed to read file: " + filename);
+	}
+	std::vector<char> data((size_t)size);
+	f.seekg(0, std::ifstream::beg);
+	if (!f.read(data.data(), data.size())) {
+		throw std::runtime_error("Failed to read file: " + filename);
 	}
 	f.close();
 
-	_parseLines(lines);
+	setMounds(parseConfig(data.data(), data.size(), filename));
 }
 
-void TerrainEditor::_parseLines(std::vector<std::string> lines) {
-	// check validity of config
-	if ((lines.size() % 5) != 0) {
-		return;
-	}
+std::vector<PackedMound> TerrainEditor::parseConfig(const char *data, size_t size, const std::string &filename) {
+	static const char *fields[5] = { "center x", "center y", "center z", "radius", "height" };
+	const char *end = data + size;
+	size_t lineNumber = 0;
+	auto fail = [&](std::string message) {
+		throw std::runtime_error(filename + ":" + std::to_string(lineNumber) + ": " + message);
+	};
+	auto isBlank = [](char c) { return (c == ' ') || (c == '\t') || (c == '\r'); };
+
+	std::vector<PackedMound> mounds;
+	mounds.reserve(size / 50); // Saved mounds take about 60 bytes
+	float values[5];
+	int field = 0;
+	for (const char *line = data; line < end; ) {
+		const char *lineEnd = (const char *)std::memchr(line, '\n', end - line);
+		lineEnd = lineEnd ? lineEnd : end;
+		lineNumber++;
+
+		// One value per line, blank lines are skipped. Spaces and the \r of Windows line endings are trimmed
+		const char *first = line;
+		const char *last = lineEnd;
+		line = lineEnd + 1;
+		while ((first < last) && isBlank(*first)) {
+			first++;
+		}
+		while ((last > first) && isBlank(last[-1])) {
+			last--;
+		}
+		if (first == last) {
+			continue;
+		}
 
-	// Parse
-	int lineNum = 1; // Current relative line number, file should in sets of 5 lines
-	_pArray.clear();
-	_rArray.clear();
-	_hArray.clear();
-	for (std::string line : lines) {
-		glm::vec3 p;
-		if (lineNum > 5) {
-			lineNum = 1;
+		// from_chars takes no leading '+', stof did
+		const char *number = ((*first == '+') && (last - first > 1) && (first[1] != '-')) ? first + 1 : first;
+		std::from_chars_result result = std::from_chars(number, last, values[field]);
+		if ((result.ec != std::errc()) || (result.ptr != last) || !std::isfinite(values[field])) {
+			fail("expected " + std::string(fields[field]) + " (mound " + std::to_string(mounds.size() + 1) + "), got '" + std::string(first, last) + "'");
 		}
-		float value = stof(line);
-
-		switch (lineNum)
-		{
-		case 1: // Center x value
-			p.x = value;
-			break;
-		case 2: // Center y value
-			p.y = value;
-			break;
-		case 3: // Center z value, also add completed vec3 to vector
-			p.z = value;
-			_pArray.push_back(p);
-			break;
-		case 4: // Add radius to vector
-			_rArray.push_back(value);
-			break;
-		case 5: // Add height to vector
-			_hArray.push_back(value);
-			break;
-		default:
-			break;
+		if (++field == 5) {
+			mounds.push_back(packMound(glm::vec3(values[0], values[1], values[2]), values[3], values[4]));
+			field = 0;
 		}
-		lineNum += 1;
+	}
+	if (field != 0) {
+		fail("file ends inside mound " + std::to_string(mounds.size() + 1) + ", expected " + fields[field]);
+	}
+	return mounds;
+}
 
+void TerrainEditor::setMounds(std::vector<PackedMound> mounds) {
+	_mounds = std::move(mounds);
+	_moundIndex.clear();
+	for (const PackedMound &record : _mounds) {
+		Mound m = unpackMound(record);
+		_moundIndex.add(m.center, m.radius);
+	}
+	_editField.rebuild(_mounds.data(), _mounds.size());
+	_revision++;
+	_editRevision++;
+}
+
+void TerrainEditor::setEditFieldResolution(int resolution) {
+	if (resolution == _editField.getResolution()) {
+		return;
 	}
+	_editField.setResolution(resolution);
+	_editField.rebuild(_mounds.data(), _mounds.size());
 }
 
 void TerrainEditor::addTerrain(glm::vec3 center, float radius, float height) {
-	_pArray.push_back(center);
-	_rArray.push_back(radius);
-	_hArray.push_back(height);
+	// Everything uses the rounded values, so the CPU, the shader and saved files agree
+	_mounds.push_back(packMound(center, radius, height));
+	Mound m = unpackMound(_mounds.back());
+	_moundIndex.add(m.center, m.radius);
+	_editField.splat(m.center, m.radius, m.height);
+	_revision++;
+	_editRevision++;
 }
 
 void TerrainEditor::undoAddTerrain() {
-	if (!_pArray.empty()) {
-		_pArray.pop_back();
-		_rArray.pop_back();
-		_hArray.pop_back();
+	if (!_mounds.empty()) {
+		Mound m = unpackMound(_mounds.back());
+		_editField.erase(m.center, m.radius, m.height);
+		_mounds.pop_back();
+		_moundIndex.removeLast();
+		_revision++;
+		_editRevision++;
 	}
 }
\ No newline at end of file
@@ -3,44 +3,123 @@
 #include <iostream>
 #include <glm/glm.hpp>
 
+#include <atomic>
+#include <cstdint>
 #include <fstream>
 #include <sstream>
 #include <vector>
+#include "moundindex.hpp"
+#include "packedmound.hpp"
+
+// Cube-sphere heightfield, six square faces stored in OpenGL cubemap order (+X, -X, +Y, -Y, +Z, -Z).
+// A bake holds displace() of unit directions and is looked up by the direction of a point, so it stands
+// for displace(normalize(p)), not displace(p): off the unit sphere the surfaces differ by up to the
+// terrain slope times |p| - 1. verifyTerrain() measures the difference
+struct Heightfield
+{
+	int resolution = 0; // Texels along one face edge
+	std::vector<float> heights = {}; // Displacement per texel, face-major then row-major (same values as displace() in f.glsl)
+	float minHeight = 0.0f; // Lowest and highest displacement in the field
+	float maxHeight = 0.0f;
+
+	inline float *face(int f) { return heights.data() + (size_t)f * resolution * resolution; }
+	inline const float *face(int f) const { return heights.data() + (size_t)f * resolution * resolution; }
+	inline size_t sizeInBytes() const { return heights.size() * sizeof(float); }
+
+	static glm::vec3 texelDirection(int face, int x, int y, int resolution); // Unit sphere direction through a texel center
+	float sample(glm::vec3 direction) const; // Bilinear lookup along a direction
+};
+
+// User mounds summed into a cube-sphere heightfield (raw mound heights, no noise or normalization), so
+// the shader reads one cubemap texel instead of looping over the edits. Each edit adds or subtracts only
+// the texels within its radius, and the touched texels of every face are collected for the next upload
+class EditField
+{
+public:
+	struct Rect { int x0 = 0, y0 = 0, x1 = -1, y1 = -1; inline bool empty() const { return x1 < x0; } }; // Inclusive texel range on one face
+
+	void setResolution(int resolution); // Clears the field and marks it all changed, 0 turns splatting off
+	inline int getResolution() const { return _field.resolution; }
+	inline const Heightfield &getField() const { return _field; } // Only heights are kept, min and max stay 0
+	void splat(glm::vec3 center, float radius, float height); // Add a mound, O(texels it covers)
+	void erase(glm::vec3 center, float radius, float height); // Subtract a mound splat() added, cancels up to float rounding
+	void rebuild(const PackedMound *mounds, size_t count); // Clear and splat all, one thread per face
+	Rect takeChanged(int face); // Texels of a face changed since the last call
+
+private:
+	void _accumulate(glm::vec3 center, float radius, float height, int firstFace = 0, int lastFace = 5);
+
+	Heightfield _field;
+	Rect _changed[6];
+};
 
 class TerrainEditor
 {
 public:
+	// Bump whenever displace() gives other values for the same seed, detail and edits (fbm, the height
+	// normalization, the mound shape or its packing), stored bakes of older versions are then ignored
+	static const uint32_t displaceVersion = 1;
+
 	TerrainEditor();
 	
-	inline void incSeed() { _seed += 1; } // Increment the current seed (aka noise sample point offset)
-	inline void decSeed() { _seed -= 1; } // Decrement the current seed
-	inline void incDetail() { _detail = glm::clamp(_detail + 1, 0, 12); } // Increment the current detail level (fbm iterations), range limited to [0, 12]
-	inline void decDetail() { _detail = glm::clamp(_detail - 1, 0, 12); } // Decrement the current detail level
-	inline int getDetailLevel() { return _detail; }
-	inline int getSeed() { return _seed; }
-	inline size_t getAddedTerrainArraySize() { return _pArray.size(); }
-	inline glm::vec3 *getAddedTerrainPointsArray() { return _pArray.data(); } // Get array start pointer
-	inline float *getAddedTerrainRadiusArray() { return _rArray.data(); }
-	inline float *getAddedTerrainHeightArray() { return _hArray.data(); }
+	inline void incSeed() { _seed += 1; _revision++; } // Increment the current seed (aka noise sample point offset)
+	inline void decSeed() { _seed -= 1; _revision++; } // Decrement the current seed
+	inline void setSeed(int seed) { if (seed != _seed) { _seed = seed; _revision++; } } // Jump to a seed
+	inline void incDetail() { _setDetail(_detail + 1); } // Increment the current detail level (fbm iterations), range limited to [0, 12]
+	inline void decDetail() { _setDetail(_detail - 1); } // Decrement the current detail level
+	inline void setDetail(int detail) { _setDetail(detail); } // Jump to a detail level, same range as incDetail
+	inline int getDetailLevel() const { return _detail; }
+	inline int getSeed() const { return _seed; }
+	inline unsigned int getRevision() { return _revision; } // Changes whenever seed, detail or edits change
+	inline unsigned int getEditRevision() { return _editRevision; } // Changes only with the edits
+	uint64_t getEditHash(); // Hash of the packed edits
+	static uint64_t hashEdits(const PackedMound *mounds, size_t count); // getEditHash() of these edits
+	inline size_t getAddedTerrainArraySize() { return _mounds.size(); }
+	inline const std::vector<PackedMound> &getMounds() const { return _mounds; } // Edits in order, as saved and uploaded
+	inline Mound getMound(size_t i) { return unpackMound(_mounds[i]); }
+	inline const MoundIndex &getMoundIndex() { _moundIndex.pack(); return _moundIndex; } // Mounds by cell, kept up to date with the edits
+	void setEditFieldResolution(int resolution); // Splat the edits into a field of this size from now on, 0 (default) for none
+	inline EditField &getEditField() { return _editField; } // Mound heights per texel, kept up to date with the edits
 	
-	void generate();
-	void load(std::string filename); // Load config file
+	float displace(glm::vec3 p); // displace() from f.glsl for a point already in planet space, evaluated at p itself (baked terrain uses normalize(p))
+	float displace(glm::vec3 p, const glm::mat3 &rotation); // displace() for a world space p, rotation is PlanetSphere::rotation
+	glm::vec4 displaceD(glm::vec3 p); // displace() with its analytic gradient in yzw, p in planet space (displaceD() in f.glsl)
+	glm::vec4 displaceD(glm::vec3 p, const glm::mat3 &rotation); // displaceD() for a world space p, gradient in world space
+	glm::vec3 surfaceNormal(glm::vec3 p, const glm::mat3 &rotation); // terrainNormal() from f.glsl, p and normal in world space
+	glm::vec2 getDisplacementBounds(); // (min, max) of displace() over the whole planet, from the empirical fbmBound() and the mounds of the worst index cell
+	float getLipschitzBound(); // Bound on the slope of the planet SDF length(p) - (1 + displace(p)) for sphere tracing, as reliable as the empirical fbmGradientBound()
+	bool generate(int resolution = 256, const std::atomic<bool> *cancel = nullptr); // Bake the heightfield on all cores, false if cancelled
+	inline const Heightfield &getHeightfield() { return _heightfield; }
+	inline Heightfield takeHeightfield() { return std::move(_heightfield); } // Move the baked heightfield out of the editor
+	void load(std::string filename); // Load config file, throws with the line number on errors and then keeps the current edits
+	static std::vector<PackedMound> parseConfig(const char *data, size_t size, const std::string &filename); // Config file contents to mounds, filename is for errors
 	void save(std::string filename); // Save config file
-	void addTerrain(glm::vec3 center, float radius, float height); // Add a mound
+	void setMounds(std::vector<PackedMound> mounds); // Replace all edits, as load does
+	void addTerrain(glm::vec3 center, float radius, float height); // Add a mound, rounded to its PackedMound (center moves onto the unit sphere)
 	void undoAddTerrain(); // Remove last point added
 
 	float clickTCRadius = 0.5f; // radius and height to use when adding terrain in placement mode
 	float clickTCHeight = 0.05f;
 
 private:
-	// these three arrays must be same size, so it is private
-	std::vector<glm::vec3> _pArray = {}; // points array (centers of mounds)
-	std::vector<float> _rArray = {}; // radius array (size of mounds)
-	std::vector<float> _hArray = {}; // height array (height of mounds)
+	std::vector<PackedMound> _mounds = {}; // Every edit in order, the only copy of the mound values
 
 	int _detail = 5; // FBM iterations
 	int _seed = 0; // Noise offset
 
-	void _parseLines(std::vector<std::string> lines); // Called by load
+	unsigned int _revision = 0; // Bumped by every change to the terrain shape
+	unsigned int _editRevision = 0;
+
+	MoundIndex _moundIndex; // Same mounds as _mounds
+	EditField _editField; // Same mounds as _mounds, while its resolution is not 0
+	glm::vec2 _moundRange = glm::vec2(0.0f); // Lowest and highest sum of mound heights (/ 0.05) over any index cell
+	float _moundSlope = 0.0f; // Highest sum of mound slopes over any index cell
+	unsigned int _moundBoundsRevision = 0; // Edit revision of the two above
+
+	Heightfield _heightfield; // Result of the last generate()
+
+	inline void _setDetail(int detail) { detail = glm::clamp(detail, 0, 12); if (detail != _detail) { _detail = detail; _revision++; } }
+	float _addMounds(glm::vec3 p, float noise); // Finish displace() from an fbm value
+	void _updateMoundBounds();
 };
 
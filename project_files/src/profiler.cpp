@@ -0,0 +1,252 @@
+#include "profiler.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+FrameProfiler::Frame::Frame() {
+	for (double &ms : gpuMs) {
+		ms = -1.0;
+	}
+	for (double &ms : cpuMs) {
+		ms = -1.0;
+	}
+}
+
+const char *FrameProfiler::gpuPassName(int pass) {
+	switch (pass) {
+	case GPU_PREPASS:
+		return "prepass";
+	case GPU_TRACE:
+		return "trace";
+	case GPU_BLIT:
+		return "blit";
+	default:
+		return "unknown";
+	}
+}
+
+const char *FrameProfiler::cpuScopeName(int scope) {
+	switch (scope) {
+	case CPU_PAINT:
+		return "paint";
+	case CPU_SCENE:
+		return "scene";
+	case CPU_SWAP:
+		return "swap";
+	default:
+		return "unknown";
+	}
+}
+
+FrameProfiler::ScopedTimer::ScopedTimer(FrameProfiler &profiler, CpuScope scope) :
+	_profiler(profiler), _scope(scope), _start(std::chrono::steady_clock::now()) {
+}
+
+FrameProfiler::ScopedTimer::~ScopedTimer() {
+	Frame *frame = _profiler.current();
+	if (frame) {
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - _start).count();
+		// A scope entered more than once per frame (e.g. readback draws) accumulates
+		frame->cpuMs[_scope] = (frame->cpuMs[_scope] < 0.0) ? ms : frame->cpuMs[_scope] + ms;
+	}
+}
+
+FrameProfiler::FrameProfiler(size_t historySize) : _historySize(historySize) {
+}
+
+void FrameProfiler::beginFrame() {
+	if (_open) {
+		endFrame();
+	}
+	auto now = std::chrono::steady_clock::now();
+	Frame frame;
+	frame.index = _nextIndex++;
+	if (frame.index > 0) {
+		frame.frameIntervalMs = std::chrono::duration<double, std::milli>(now - _lastBegin).count();
+	}
+	_lastBegin = now;
+	_inFlight.push_back(frame);
+	_open = true;
+}
+
+void FrameProfiler::endFrame() {
+	for (int pass = 0; pass < GPU_PASS_COUNT; pass++) {
+		if (_timing[pass]) {
+			endGpu((GpuPass)pass);
+		}
+	}
+	_open = false;
+}
+
+FrameProfiler::Frame *FrameProfiler::current() {
+	return _open ? &_inFlight.back() : nullptr;
+}
+
+void FrameProfiler::beginGpu(GpuPass pass) {
+	if (!_open || _timing[pass]) {
+		return;
+	}
+	if (!_timers[pass]) {
+		_timers[pass].reset(new GpuTimer(8));
+	}
+	// A full ring leaves this pass untimed for the frame rather than waiting on the GPU
+	if (_timers[pass]->begin()) {
+		_timing[pass] = true;
+		_timerFrames[pass].push_back(_inFlight.back().index);
+		_inFlight.back().pendingGpu++;
+	}
+}
+
+void FrameProfiler::endGpu(GpuPass pass) {
+	if (_timing[pass]) {
+		_timers[pass]->end();
+		_timing[pass] = false;
+	}
+}
+
+FrameProfiler::Frame *FrameProfiler::_find(uint64_t index) {
+	if (_inFlight.empty() || (index < _inFlight.front().index)) {
+		return nullptr;
+	}
+	size_t i = (size_t)(index - _inFlight.front().index);
+	return (i < _inFlight.size()) ? &_inFlight[i] : nullptr;
+}
+
+std::vector<FrameProfiler::Frame> FrameProfiler::poll() {
+	for (int pass = 0; pass < GPU_PASS_COUNT; pass++) {
+		double ms;
+		while (_timers[pass] && !_timing[pass] && _timers[pass]->poll(ms)) {
+			Frame *frame = _find(_timerFrames[pass].front());
+			_timerFrames[pass].pop_front();
+			if (frame) {
+				frame->gpuMs[pass] = ms;
+				frame->pendingGpu--;
+			}
+		}
+	}
+
+	// Frames complete in order, a slow pass holds back the frames after it
+	std::vector<Frame> completed;
+	while (!_inFlight.empty() && (_inFlight.front().pendingGpu == 0) && !(_open && (_inFlight.size() == 1))) {
+		completed.push_back(_inFlight.front());
+		_history.push_back(_inFlight.front());
+		_inFlight.pop_front();
+		if (_history.size() > _historySize) {
+			_history.pop_front();
+		}
+	}
+	return completed;
+}
+
+std::string FrameProfiler::summary(double windowMs) {
+	// Most recent frames covering windowMs
+	size_t count = 0;
+	double spanMs = 0.0;
+	for (auto it = _history.rbegin(); (it != _history.rend()) && (spanMs < windowMs); ++it) {
+		spanMs += std::max(it->frameIntervalMs, 0.0);
+		count++;
+	}
+	if (count == 0) {
+		return "No frames profiled yet";
+	}
+
+	double gpu[GPU_PASS_COUNT] = {}, cpu[CPU_SCOPE_COUNT] = {};
+	int gpuCount[GPU_PASS_COUNT] = {}, cpuCount[CPU_SCOPE_COUNT] = {}, redrawn = 0;
+	for (size_t i = _history.size() - count; i < _history.size(); i++) {
+		const Frame &frame = _history[i];
+		for (int pass = 0; pass < GPU_PASS_COUNT; pass++) {
+			if (frame.gpuMs[pass] >= 0.0) {
+				gpu[pass] += frame.gpuMs[pass];
+				gpuCount[pass]++;
+			}
+		}
+		for (int scope = 0; scope < CPU_SCOPE_COUNT; scope++) {
+			if (frame.cpuMs[scope] >= 0.0) {
+				cpu[scope] += frame.cpuMs[scope];
+				cpuCount[scope]++;
+			}
+		}
+		redrawn += frame.redrawn ? 1 : 0;
+	}
+
+	const Frame &last = _history.back();
+	std::ostringstream s;
+	char buf[64];
+	snprintf(buf, sizeof(buf), "%.1f", (spanMs > 0.0) ? 1000.0 * count / spanMs : 0.0);
+	s << count << " frames (" << redrawn << " redrawn), " << buf << " fps | cpu ms";
+	for (int scope = 0; scope < CPU_SCOPE_COUNT; scope++) {
+		snprintf(buf, sizeof(buf), "%.2f", cpuCount[scope] ? cpu[scope] / cpuCount[scope] : 0.0);
+		s << " " << cpuScopeName(scope) << " " << buf;
+	}
+	s << " | gpu ms";
+	for (int pass = 0; pass < GPU_PASS_COUNT; pass++) {
+		snprintf(buf, sizeof(buf), "%.2f", gpuCount[pass] ? gpu[pass] / gpuCount[pass] : 0.0);
+		s << " " << gpuPassName(pass) << " " << buf;
+	}
+	s << " | " << last.renderWidth << "x" << last.renderHeight << " of " << last.width << "x" << last.height
+		<< ", detail " << last.detail << ", " << last.edits << " edits";
+	return s.str();
+}
+
+void FrameProfiler::writeCsv(std::string filename) {
+	std::ofstream f(filename, std::ofstream::out | std::ofstream::trunc);
+	if (!f.is_open()) {
+		throw std::runtime_error("Failed to open file: " + filename);
+	}
+
+	f << "frame,interval_ms";
+	for (int scope = 0; scope < CPU_SCOPE_COUNT; scope++) {
+		f << ",cpu_" << cpuScopeName(scope) << "_ms";
+	}
+	for (int pass = 0; pass < GPU_PASS_COUNT; pass++) {
+		f << ",gpu_" << gpuPassName(pass) << "_ms";
+	}
+	f << ",redrawn,changed,width,height,render_width,render_height,detail,edits,march_mode,performance_mode,hard_shadows,baked_terrain,splat_edits,depth_prepass\n";
+
+	for (const Frame &frame : _history) {
+		f << frame.index << "," << frame.frameIntervalMs;
+		for (double ms : frame.cpuMs) {
+			f << "," << ms;
+		}
+		for (double ms : frame.gpuMs) {
+			f << "," << ms;
+		}
+		f << "," << frame.redrawn << "," << frame.changed << "," << frame.width << "," << frame.height
+			<< "," << frame.renderWidth << "," << frame.renderHeight << "," << frame.detail << "," << frame.edits
+			<< "," << frame.marchMode << "," << frame.performanceMode << "," << frame.hardShadows
+			<< "," << frame.bakedTerrain << "," << frame.splatEdits << "," << frame.depthPrepass << "\n";
+	}
+}
+
+void FrameProfiler::writeJson(std::string filename) {
+	std::ofstream f(filename, std::ofstream::out | std::ofstream::trunc);
+	if (!f.is_open()) {
+		throw std::runtime_error("Failed to open file: " + filename);
+	}
+
+	// Same fields as the CSV, unmeasured timings are null
+	auto ms = [](double value) { std::ostringstream s; if (value < 0.0) s << "null"; else s << value; return s.str(); };
+	auto flag = [](bool value) { return value ? "true" : "false"; };
+	f << "[\n";
+	for (size_t i = 0; i < _history.size(); i++) {
+		const Frame &frame = _history[i];
+		f << "  {\"frame\": " << frame.index << ", \"interval_ms\": " << ms(frame.frameIntervalMs);
+		for (int scope = 0; scope < CPU_SCOPE_COUNT; scope++) {
+			f << ", \"cpu_" << cpuScopeName(scope) << "_ms\": " << ms(frame.cpuMs[scope]);
+		}
+		for (int pass = 0; pass < GPU_PASS_COUNT; pass++) {
+			f << ", \"gpu_" << gpuPassName(pass) << "_ms\": " << ms(frame.gpuMs[pass]);
+		}
+		f << ", \"redrawn\": " << flag(frame.redrawn) << ", \"changed\": " << flag(frame.changed)
+			<< ", \"width\": " << frame.width << ", \"height\": " << frame.height
+			<< ", \"render_width\": " << frame.renderWidth << ", \"render_height\": " << frame.renderHeight
+			<< ", \"detail\": " << frame.detail << ", \"edits\": " << frame.edits << ", \"march_mode\": " << frame.marchMode
+			<< ", \"performance_mode\": " << flag(frame.performanceMode) << ", \"hard_shadows\": " << flag(frame.hardShadows)
+			<< ", \"baked_terrain\": " << flag(frame.bakedTerrain) << ", \"splat_edits\": " << flag(frame.splatEdits)
+			<< ", \"depth_prepass\": " << flag(frame.depthPrepass) << "}"
+			<< ((i + 1 < _history.size()) ? ",\n" : "\n");
+	}
+	f << "]\n";
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include "gputimer.hpp"
+
+// Per frame timings and counters. GPU passes are timed with GpuTimer rings, so a frame record is
+// complete a few frames after it was drawn, CPU scopes are timed with steady_clock right away.
+// Completed frames are kept in a bounded history for the rolling summary and CSV/JSON export.
+class FrameProfiler
+{
+public:
+	// GL_TIME_ELAPSED queries cannot nest, passes must not overlap
+	enum GpuPass {
+		GPU_PREPASS = 0,	// Low resolution cone march
+		GPU_TRACE,			// Full sphere tracing and shading draw
+		GPU_BLIT,			// Frame cache to window
+		GPU_PASS_COUNT
+	};
+	enum CpuScope {
+		CPU_PAINT = 0,		// All of GLState::paintGL
+		CPU_SCENE,			// Uniform uploads and draw submission in GLState::drawScene
+		CPU_SWAP,			// Buffer swap, includes any vsync wait
+		CPU_SCOPE_COUNT
+	};
+	static const char *gpuPassName(int pass);
+	static const char *cpuScopeName(int scope);
+
+	struct Frame {
+		uint64_t index = 0;
+		double gpuMs[GPU_PASS_COUNT];		// Negative when the pass did not run or was not timed
+		double cpuMs[CPU_SCOPE_COUNT];		// Negative when the scope did not run
+		double frameIntervalMs = -1.0;		// Since the previous presented frame
+		bool redrawn = false;				// Scene drawn, not just the cached frame blitted
+		bool changed = false;				// Redrawn because the scene changed (not a full size refresh)
+		int width = 0, height = 0;			// Window
+		int renderWidth = 0, renderHeight = 0;
+		int detail = 0;
+		int edits = 0;
+		int marchMode = 0;
+		bool performanceMode = false;
+		bool hardShadows = false;
+		bool bakedTerrain = false;
+		bool splatEdits = false;
+		bool depthPrepass = false;
+		int pendingGpu = 0;					// Queries not yet read back
+		Frame();
+	};
+
+	// Times a CPU scope of the open frame from construction to destruction
+	class ScopedTimer {
+	public:
+		ScopedTimer(FrameProfiler &profiler, CpuScope scope);
+		~ScopedTimer();
+	private:
+		FrameProfiler &_profiler;
+		CpuScope _scope;
+		std::chrono::steady_clock::time_point _start;
+	};
+
+	FrameProfiler(size_t historySize = 3600);
+
+	void beginFrame();						// Closes the previous frame if still open
+	void endFrame();
+	Frame *current();						// Open frame for counters, nullptr between frames
+	void beginGpu(GpuPass pass);			// No-ops between frames
+	void endGpu(GpuPass pass);
+	std::vector<Frame> poll();				// Read finished queries, returns frames completed since the last poll
+
+	inline const std::deque<Frame> &getHistory() { return _history; }	// Completed frames, oldest first
+	std::string summary(double windowMs = 1000.0);	// Averages over the most recent windowMs of frames
+	void writeCsv(std::string filename);
+	void writeJson(std::string filename);
+
+private:
+	size_t _historySize;
+	uint64_t _nextIndex = 0;
+	bool _open = false;
+	std::chrono::steady_clock::time_point _lastBegin;
+	std::deque<Frame> _inFlight = {};		// Back is the open frame while _open
+	std::deque<Frame> _history = {};
+	std::unique_ptr<GpuTimer> _timers[GPU_PASS_COUNT];
+	std::deque<uint64_t> _timerFrames[GPU_PASS_COUNT];	// Frame index of each pending query, in ring order
+	bool _timing[GPU_PASS_COUNT] = {};		// Query of the open frame in progress
+
+	Frame *_find(uint64_t index);
+};
@@ -0,0 +1,143 @@
+#include "programcache.hpp"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+// File layout: header followed by the driver's binary blob
+struct ProgramFileHeader {
+	char magic[8];
+	uint64_t key;
+	uint32_t format;	// GLenum reported by glGetProgramBinary
+	uint32_t length;
+};
+
+static const char programFileMagic[8] = { 'P', 'P', 'P', 'R', 'O', 'G', '1', '\0' };
+
+uint64_t ProgramCache::key(const std::vector<std::string> &sources, const std::vector<std::string> &defines) {
+	// FNV-1a, every string followed by a terminator so boundaries count
+	uint64_t hash = 14695981039346656037ull;
+	auto add = [&hash](const char *s, size_t bytes) {
+		for (size_t i = 0; i < bytes; i++) {
+			hash = (hash ^ (unsigned char)s[i]) * 1099511628211ull;
+		}
+		hash = (hash ^ 0xffu) * 1099511628211ull;
+	};
+	for (const std::string &source : sources) {
+		add(source.data(), source.size());
+	}
+	for (const std::string &define : defines) {
+		add(define.data(), define.size());
+	}
+	for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION }) {
+		const char *s = (const char *)glGetString(name);
+		add(s ? s : "", s ? std::strlen(s) : 0);
+	}
+	return hash;
+}
+
+void ProgramCache::setDirectory(std::string directory) {
+	_directory = directory;
+	if (!_directory.empty()) {
+		std::filesystem::create_directories(_directory);
+	}
+}
+
+bool ProgramCache::isEnabled() {
+	if (_directory.empty()) {
+		return false;
+	}
+	if (_supported < 0) {
+		// Core since 4.1, an extension on older contexts. Some drivers expose it with no formats
+		GLint major = 0, minor = 0, extensions = 0, formats = 0;
+		glGetIntegerv(GL_MAJOR_VERSION, &major);
+		glGetIntegerv(GL_MINOR_VERSION, &minor);
+		bool available = (major > 4) || ((major == 4) && (minor >= 1));
+		glGetIntegerv(GL_NUM_EXTENSIONS, &extensions);
+		for (GLint i = 0; (i < extensions) && !available; i++) {
+			const char *name = (const char *)glGetStringi(GL_EXTENSIONS, i);
+			available = name && (std::strcmp(name, "GL_ARB_get_program_binary") == 0);
+		}
+		if (available) {
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		}
+		_supported = (available && (formats > 0)) ? 1 : 0;
+	}
+	return _supported == 1;
+}
+
+std::string ProgramCache::_path(uint64_t key) {
+	std::stringstream ss;
+	ss << std::hex << std::setw(16) << std::setfill('0') << key << ".prog";
+	return (std::filesystem::path(_directory) / ss.str()).string();
+}
+
+GLuint ProgramCache::load(uint64_t key) {
+	if (!isEnabled()) {
+		return 0;
+	}
+	std::string path = _path(key);
+	std::vector<char> binary;
+	ProgramFileHeader header;
+	{
+		std::ifstream f(path, std::ios::binary);
+		if (!f.is_open()) {
+			return 0;
+		}
+		if (!f.read((char *)&header, sizeof(header)) || (std::memcmp(header.magic, programFileMagic, sizeof(programFileMagic)) != 0) || (header.key != key)) {
+			binary.clear();
+		}
+		else {
+			binary.resize(header.length);
+			if (!f.read(binary.data(), binary.size())) {
+				binary.clear();
+			}
+		}
+	}
+
+	// The driver may still reject a binary it wrote, e.g. after an update that kept the version string
+	GLuint program = 0;
+	if (!binary.empty()) {
+		program = glCreateProgram();
+		glProgramBinary(program, (GLenum)header.format, binary.data(), (GLsizei)binary.size());
+		GLint status = GL_FALSE;
+		glGetProgramiv(program, GL_LINK_STATUS, &status);
+		if (status == GL_FALSE) {
+			glDeleteProgram(program);
+			program = 0;
+		}
+	}
+	if (!program) {
+		std::error_code ec;
+		std::filesystem::remove(path, ec); // Rewritten after the source compile
+	}
+	return program;
+}
+
+void ProgramCache::save(uint64_t key, GLuint program) {
+	if (!isEnabled()) {
+		return;
+	}
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0) {
+		return;
+	}
+	std::vector<char> binary(length);
+	GLenum format = 0;
+	glGetProgramBinary(program, length, &length, &format, binary.data());
+
+	std::string path = _path(key);
+	std::ofstream f(path, std::ios::binary | std::ofstream::trunc);
+	if (!f.is_open()) {
+		return; // A read-only cache only costs the speedup
+	}
+	ProgramFileHeader header;
+	std::memcpy(header.magic, programFileMagic, sizeof(programFileMagic));
+	header.key = key;
+	header.format = format;
+	header.length = (uint32_t)length;
+	f.write((const char *)&header, sizeof(header));
+	f.write(binary.data(), length);
+}
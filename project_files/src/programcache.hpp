@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "gl_core_3_3.h"
+
+// Linked shader programs saved with glGetProgramBinary and restored with glProgramBinary, so warm
+// starts and shader variant switches skip compiling. Drivers without ARB_get_program_binary (or
+// with zero binary formats) and any file that fails to load fall back to compiling from source.
+class ProgramCache
+{
+public:
+	// Identifies a program by its sources, defines and the driver that built it. Driver updates
+	// and edited shader files get new keys, stale files are simply never loaded again
+	uint64_t key(const std::vector<std::string> &sources, const std::vector<std::string> &defines);
+
+	void setDirectory(std::string directory);	// Disabled while the directory is empty
+	bool isEnabled();							// Directory set and binaries supported, needs a current context
+	GLuint load(uint64_t key);					// Linked program, 0 on a miss or a rejected binary
+	void save(uint64_t key, GLuint program);	// Program must be linked with the retrievable hint
+
+private:
+	std::string _path(uint64_t key);
+
+	std::string _directory = "";
+	int _supported = -1;	// Unknown until the first query with a context
+};
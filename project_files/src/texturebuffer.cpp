@@ -0,0 +1,68 @@
+#include "texturebuffer.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+TextureBuffer::TextureBuffer(GLenum internalFormat, size_t texelBytes) : _format(internalFormat), _texelBytes(texelBytes) {}
+
+TextureBuffer::~TextureBuffer() {
+	// Release OpenGL resources
+	if (_texture)	glDeleteTextures(1, &_texture);
+	if (_buffer)	glDeleteBuffers(1, &_buffer);
+}
+
+void TextureBuffer::update(const void *data, size_t bytes) {
+	const unsigned char *in = (const unsigned char *)data;
+	glBindBuffer(GL_TEXTURE_BUFFER, _buffer);
+
+	if (!_buffer || (bytes > _capacity)) {
+		// Double until it fits, then send everything into the new store
+		size_t capacity = std::max(_capacity, (size_t)4096);
+		while (capacity < bytes) {
+			capacity *= 2;
+		}
+		GLint maxTexels = 0;
+		glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+		if (bytes / _texelBytes > (size_t)maxTexels) {
+			throw std::runtime_error("Texture buffer of " + std::to_string(bytes / _texelBytes) + " texels exceeds GL_MAX_TEXTURE_BUFFER_SIZE (" + std::to_string(maxTexels) + ")");
+		}
+		capacity = std::min(capacity, (size_t)maxTexels * _texelBytes);
+
+		if (!_buffer) {
+			glGenBuffers(1, &_buffer);
+			glGenTextures(1, &_texture);
+			glBindBuffer(GL_TEXTURE_BUFFER, _buffer);
+		}
+		glBufferData(GL_TEXTURE_BUFFER, capacity, NULL, GL_DYNAMIC_DRAW);
+		if (bytes > 0) {
+			glBufferSubData(GL_TEXTURE_BUFFER, 0, bytes, in);
+		}
+		// The texture follows the buffer object, so it is attached once
+		if (_capacity == 0) {
+			glBindTexture(GL_TEXTURE_BUFFER, _texture);
+			glTexBuffer(GL_TEXTURE_BUFFER, _format, _buffer);
+			glBindTexture(GL_TEXTURE_BUFFER, 0);
+		}
+		_capacity = capacity;
+		_lastUploadBytes = bytes;
+	}
+	else {
+		// Only the span between the first and the last changed byte. Bytes past the old size are new
+		const unsigned char *old = _contents.data();
+		size_t common = std::min(bytes, _contents.size());
+		size_t first = std::mismatch(in, in + common, old).first - in;
+		size_t end = bytes;
+		if (bytes <= _contents.size()) {
+			while ((end > first) && (in[end - 1] == old[end - 1])) {
+				end--;
+			}
+		}
+		if (end > first) {
+			glBufferSubData(GL_TEXTURE_BUFFER, first, end - first, in + first);
+		}
+		_lastUploadBytes = end - first;
+	}
+
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	_contents.assign(in, in + bytes);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include "gl_core_3_3.h"
+
+// Buffer texture whose contents are replaced as a whole but sent in part. Storage grows
+// geometrically, so appending stays cheap, and an update only uploads the span that differs
+// from what the buffer already holds
+class TextureBuffer
+{
+public:
+	TextureBuffer(GLenum internalFormat, size_t texelBytes);
+	~TextureBuffer();
+	// Disallow copy, move, & assignment
+	TextureBuffer(const TextureBuffer& other) = delete;
+	TextureBuffer& operator=(const TextureBuffer& other) = delete;
+
+	void update(const void *data, size_t bytes); // Needs a current context, throws past GL_MAX_TEXTURE_BUFFER_SIZE
+	inline GLuint getTexture() { return _texture; }
+	inline size_t getCapacity() { return _capacity; } // Bytes allocated
+	inline size_t getLastUploadBytes() { return _lastUploadBytes; }
+
+private:
+	GLenum _format;
+	size_t _texelBytes;
+	GLuint _buffer = 0;
+	GLuint _texture = 0;
+	size_t _capacity = 0;
+	std::vector<unsigned char> _contents = {}; // Copy of what the buffer holds
+	size_t _lastUploadBytes = 0;
+};
@@ -3,9 +3,8 @@
 #include <fstream>
 #include "util.hpp"
 
-// Compile a single shader stage
-GLuint compileShader(GLenum type, const std::string& filename) {
-	// Read the file
+// Read a shader file
+std::string loadShaderSource(const std::string& filename) {
 	std::ifstream file(filename);
 	if (!file.is_open()) {
 		std::stringstream ss;
@@ -13,10 +12,26 @@ GLuint compileShader(GLenum type, const std::string& filename) {
 		throw std::runtime_error(ss.str());
 	}
 
-	// Read the shader source
 	std::stringstream buffer;
 	buffer << file.rdbuf();
-	std::string bufStr = buffer.str();
+	return buffer.str();
+}
+
+// Compile a single shader stage
+GLuint compileShader(GLenum type, const std::string& filename, const std::vector<std::string>& defines) {
+	// Read the shader source
+	std::string bufStr = loadShaderSource(filename);
+
+	// Defines go right after #version, #line keeps error line numbers pointing into the file
+	if (!defines.empty()) {
+		size_t versionEnd = (bufStr.compare(0, 8, "#version") == 0) ? bufStr.find('\n') + 1 : 0;
+		std::string header;
+		for (const std::string &define : defines) {
+			header += "#define " + define + "\n";
+		}
+		header += "#line " + std::to_string(versionEnd ? 2 : 1) + "\n";
+		bufStr.insert(versionEnd, header);
+	}
 	const char* bufCStr = bufStr.c_str();
 	GLint length = (GLint)bufStr.length();
 
@@ -37,7 +52,11 @@ GLuint compileShader(GLenum type, const std::string& filename) {
 
 		// Construct an error message with the compile log
 		std::stringstream ss;
-		ss << "Error compiling " << filename << ":" << std::endl << std::endl;
+		ss << "Error compiling " << filename;
+		for (const std::string &define : defines) {
+			ss << " [" << define << "]";
+		}
+		ss << ":" << std::endl << std::endl;
 		ss << logText.data() << std::endl;
 
 		// Cleanup shader and throw an exception
@@ -49,8 +68,11 @@ GLuint compileShader(GLenum type, const std::string& filename) {
 }
 
 // Link compiled shader stages into a single program
-GLuint linkProgram(std::vector<GLuint>& shaders) {
+GLuint linkProgram(std::vector<GLuint>& shaders, bool retrievable) {
 	GLuint program = glCreateProgram();
+	if (retrievable) {
+		glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	}
 
 	// Attach the shaders and link the program
 	for (auto it = shaders.begin(); it != shaders.end(); ++it)
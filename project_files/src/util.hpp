@@ -5,7 +5,8 @@
 #include <vector>
 #include "gl_core_3_3.h"
 
-GLuint compileShader(GLenum type, const std::string& filename);
-GLuint linkProgram(std::vector<GLuint>& shaders);
+std::string loadShaderSource(const std::string& filename);
+GLuint compileShader(GLenum type, const std::string& filename, const std::vector<std::string>& defines = {}); // defines are "NAME VALUE"
+GLuint linkProgram(std::vector<GLuint>& shaders, bool retrievable = false); // retrievable: binary will be read for ProgramCache
 
 #endif